@@ -0,0 +1,137 @@
+// Read path benchmarks against simulated readers, prints one JSON document to stdout.
+//
+//   node bench.js [--duration ms] [--readers 1,2,4,8,16] [--workloads uid,classic1k,...] [--latency us]
+
+var nfc  = require('./index').nfc
+  , os   = require('os')
+  ;
+
+// Each workload is a simulated card plus the start options of its readers. Cards stay on the reader and
+// presence tracking is off, so readers read back to back, except for the taps workload.
+var workloads = {
+  'uid'              : { card: 'classic1k',                       start: { read: 'uid', presence: false } },
+  'classic1k'        : { card: 'classic1k',                       start: { presence: false } },
+  'classic1k-lastkey': { card: 'classic1k,key=abcdef123456',      start: { presence: false, keyCache: false } },
+  'classic1k-cached' : { card: 'classic1k,key=abcdef123456',      start: { presence: false } },
+  'classic4k'        : { card: 'classic4k',                       start: { presence: false } },
+  'ntag215'          : { card: 'ntag215',                         start: { presence: false } },
+  'ntag215-ndef'     : { card: 'ntag215',                         start: { read: 'ndef', parseNdef: true, presence: false } },
+  'taps'             : { card: 'ntag213,cards=64,dwell=20,gap=5', start: { debounce: 0, presenceInterval: 5 } }
+};
+
+var config = { duration: 2000, warmup: 250, readers: [ 1, 2, 4, 8, 16 ], workloads: Object.keys(workloads), latency: 0 };
+
+for (var i = 2; i < process.argv.length; i += 2) {
+  var name = process.argv[i].replace(/^--/, ''), value = process.argv[i + 1];
+  if (name === 'duration' || name === 'latency') config[name] = parseInt(value, 10);
+  else if (name === 'readers') config.readers = value.split(',').map(function(n) { return parseInt(n, 10); });
+  else if (name === 'workloads') config.workloads = value.split(',');
+  else {
+    console.error('unknown option ' + process.argv[i]);
+    process.exit(1);
+  }
+}
+config.workloads.forEach(function(name) {
+  if (!workloads[name]) {
+    console.error('unknown workload ' + name);
+    process.exit(1);
+  }
+});
+
+function cpuTime() {
+  var usage = process.cpuUsage();
+  return usage.user + usage.system;
+}
+
+function median(values) {
+  values = values.slice().sort(function(a, b) { return a - b; });
+  return values.length ? values[Math.floor((values.length - 1) / 2)] : 0;
+}
+
+// Histograms are per reader, so latency is reported as the median p50 and the worst p99 across readers.
+function run(workload, count, done) {
+  var readers = [], baseline = [], started, cpu, stopped = 0;
+
+  for (var r = 0; r < count; r++) {
+    var reader = new nfc.NFC(), options = {};
+    for (var k in workload.start) options[k] = workload.start[k];
+    options.timings = true;
+
+    reader.on('read', function() {}).on('error', function() {});
+    reader.start('sim:' + workload.card + ',latency=' + config.latency + ',seed=' + (r + 1), options);
+    readers.push(reader);
+  }
+
+  setTimeout(function() {
+    readers.forEach(function(reader, r) {
+      reader.stats({ reset: true });
+      baseline[r] = reader.queueStats().allocations;
+    });
+    started = process.hrtime();
+    cpu = cpuTime();
+
+    setTimeout(function() {
+      var elapsed = process.hrtime(started), seconds = elapsed[0] + elapsed[1] / 1e9
+        , used = cpuTime() - cpu
+        , stats = readers.map(function(reader) { return reader.stats(); })
+        , allocations = 0, reads = 0, failed = 0;
+
+      readers.forEach(function(reader, r) { allocations += reader.queueStats().allocations - baseline[r]; });
+      stats.forEach(function(s) {
+        reads += s.reads;
+        failed += s.failedReads;
+      });
+
+      var result = { readers                 : count
+                   , durationMs              : Math.round(seconds * 1000)
+                   , reads                   : reads
+                   , failedReads             : failed
+                   , readsPerSecond          : reads / seconds
+                   , readsPerSecondPerReader : reads / seconds / count
+                   , latencyUs               : { p50 : median(stats.map(function(s) { return s.latency.p50; }))
+                                               , p99 : Math.max.apply(null, stats.map(function(s) { return s.latency.p99; }))
+                                               }
+                   , readUs                  : { p50 : median(stats.map(function(s) { return s.read.p50; }))
+                                               , p99 : Math.max.apply(null, stats.map(function(s) { return s.read.p99; }))
+                                               }
+                   , framesPerRead           : median(stats.map(function(s) { return s.frames.mean; }))
+                   , cpuUsPerRead            : reads ? used / reads : null
+                   , allocationsPerRead      : reads ? allocations / reads : null
+                   };
+
+      readers.forEach(function(reader) {
+        reader.once('stopped', function() { if (++stopped === count) done(result); });
+        reader.stop();
+      });
+    }, config.duration);
+  }, config.warmup);
+}
+
+var plan = [];
+config.workloads.forEach(function(name) {
+  config.readers.forEach(function(count) { plan.push({ name: name, readers: count }); });
+});
+
+var report = { date      : new Date().toISOString()
+             , node      : process.version
+             , libnfc    : nfc.version().version
+             , platform  : os.platform() + ' ' + os.arch()
+             , cpus      : os.cpus().length
+             , config    : config
+             , results   : []
+             };
+
+(function next() {
+  var step = plan.shift();
+  if (!step) {
+    console.log(JSON.stringify(report, null, 2));
+    return;
+  }
+
+  console.error(step.name + ' x' + step.readers);
+  run(workloads[step.name], step.readers, function(result) {
+    result.workload = step.name;
+    report.results.push(result);
+    setTimeout(next, 50);
+  });
+})();
@@ -1,7 +1,7 @@
 {
   "targets": [ {
       "target_name": "nfc",
-      "sources": [ "src/nfc.cc" ],
+      "sources": [ "src/nfc.cc", "src/key_cache.cc", "src/ndef.cc", "src/device_info.cc", "src/transport.cc", "src/sim.cc", "src/journal.cc" ],
       "libraries": [ "-lnfc", "-L/usr/local/lib/" ],
       "include_dirs": [
         "<!(node -e \"require('nan')\")",
@@ -1,6 +1,6 @@
 var nfc    = require('bindings')('nfc')
   , events = require('events')
-  , ndef   = require('ndef')
+  , stream = require('stream')
   ;
 
 var inherits = function(target, source) {
@@ -9,86 +9,275 @@ var inherits = function(target, source) {
     }
 };
 inherits(nfc.NFC, events.EventEmitter);
+inherits(nfc.DeviceMonitor, events.EventEmitter);
 
-exports.nfc = { version : nfc.version
-              , NFC     : nfc.NFC
-              };
+// stop() returns immediately, the native reader emits 'stopped' once its thread has exited.
+var stop = nfc.NFC.prototype.stop;
+nfc.NFC.prototype.stop = function() {
+  var self = this, pending = stop.call(this);
+
+  if (typeof Promise !== 'function') return this;
+  if (!pending) return Promise.resolve();
+  return new Promise(function(resolve) { self.once('stopped', resolve); });
+};
+
+// detach() stops the reader but keeps its device open for start(deviceID) on another thread, e.g. a worker.
+var detach = nfc.NFC.prototype.detach;
+nfc.NFC.prototype.detach = function() {
+  var self = this, deviceID = detach.call(this);
+
+  if (typeof Promise !== 'function') return deviceID;
+  return new Promise(function(resolve, reject) {
+    var detached = false;
+    var onDetached = function() { detached = true; };
+
+    self.once('detached', onDetached).once('stopped', function(err) {
+      self.removeListener('detached', onDetached);
+      if (detached) resolve(deviceID);
+      else reject(err || new Error('NFC device stopped before it was detached'));
+    });
+  });
+};
+
+// Every response of a transceive() script comes back in one Buffer, responses are views into it.
+var transceive = nfc.NFC.prototype.transceive;
+nfc.NFC.prototype.transceive = function(script, callback) {
+  if (typeof callback !== 'function') return transceive.call(this, script, callback);
+
+  return transceive.call(this, script, function(err, result) {
+    if (err) return callback(err);
 
-exports.nfc.parse = function(data) {
-  var bytes, i, results, tlv;
+    var offset = 0;
+    result.responses = result.lengths.map(function(length) {
+      var response = result.data.slice(offset, offset + length);
+      offset += length;
+      return response;
+    });
+    callback(null, result);
+  });
+};
+
+// Resolves with the next 'read', polling only until it arrives when the reader was paused.
+nfc.NFC.prototype.readOnce = function(options) {
+  var self = this, timeout = (options || {}).timeout, wasPaused = this.resume();
 
-  results = [];
+  return new Promise(function(resolve, reject) {
+    var timer;
+    var done = function() {
+      clearTimeout(timer);
+      self.removeListener('read', onRead);
+      self.removeListener('stopped', onStopped);
+      if (wasPaused) self.pause();
+    };
+    var onRead = function(tag) {
+      done();
+      resolve(tag);
+    };
+    var onStopped = function(err) {
+      done();
+      reject(err || new Error('NFC device stopped'));
+    };
 
-  for (i = 0, bytes = data.toJSON().data; i < bytes.length; i += tlv.len) {
-    tlv = { type: bytes[i++] };
-    if ((tlv.type === 0xfe) || (i >= bytes.length)) {
-      results.push(tlv);
-      break;
+    self.on('read', onRead).on('stopped', onStopped);
+    if (timeout) timer = setTimeout(function() {
+      done();
+      reject(new Error('no tag read within ' + timeout + 'ms'));
+    }, timeout);
+  });
+};
+
+// Async iterator over reads. Polling pauses while highWaterMark reads wait for the consumer and
+// resumes on the next pull, the iterator ends with the reader (rejecting when it was lost).
+nfc.NFC.prototype.reads = function(options) {
+  var self = this, highWaterMark = (options || {}).highWaterMark || 1
+    , buffered = [], pulls = [], ended = false, failure = null, wasPaused;
+
+  var finish = function(err) {
+    if (ended) return;
+    ended = true;
+    failure = err || null;
+    self.removeListener('read', onRead);
+    self.removeListener('stopped', onStopped);
+    if (wasPaused) self.pause();
+    else self.resume();
+    while (pulls.length) {
+      var pull = pulls.shift();
+      if (failure) pull.reject(failure);
+      else pull.resolve({ value: undefined, done: true });
+      failure = null;   // reported once, later pulls are done
     }
+  };
+  var onRead = function(tag) {
+    if (pulls.length) return pulls.shift().resolve({ value: tag, done: false });
+    buffered.push(tag);
+    if (buffered.length >= highWaterMark) self.pause();
+  };
+  var onStopped = function(err) { finish(err); };
+
+  this.on('read', onRead).on('stopped', onStopped);
+  wasPaused = this.resume();
 
-    tlv.len = bytes[i++];
-    if (tlv.len === 0xff) {
-      if ((i + 1) >= bytes.length) break;
-      tlv.len = bytes[i++] << 8;
-      tlv.len += bytes[i++];
+  var iterator = {
+    next: function() {
+      if (buffered.length) {
+        var tag = buffered.shift();
+        if (!ended) self.resume();
+        return Promise.resolve({ value: tag, done: false });
+      }
+      if (ended) {
+        var err = failure;
+        failure = null;
+        return err ? Promise.reject(err) : Promise.resolve({ value: undefined, done: true });
+      }
+      self.resume();
+      return new Promise(function(resolve, reject) { pulls.push({ resolve: resolve, reject: reject }); });
+    },
+    return: function() {
+      buffered = [];
+      finish();
+      return Promise.resolve({ value: undefined, done: true });
     }
-    if ((tlv.len > 0) && ((i + tlv.len) < bytes.length)) tlv.value = bytes.slice(i, i + tlv.len);
-    if ((tlv.type === 0x03) && (!!tlv.value)) tlv.ndef = ndef.decodeMessage(tlv.value);
-    if (!!tlv.value) tlv.value = ndef.util.bytesToHexString(tlv.value);
-    results.push(tlv);
+  };
+  if (typeof Symbol === 'function' && Symbol.asyncIterator) iterator[Symbol.asyncIterator] = function() { return this; };
+  return iterator;
+};
+
+if (typeof Symbol === 'function' && Symbol.asyncIterator) {
+  nfc.NFC.prototype[Symbol.asyncIterator] = function() { return this.reads(); };
+}
+
+// Keeps a reader started on every attached device. A reader that loses its device (e.g. a USB glitch)
+// is started again as soon as the device answers, its NFC object and listeners stay the same.
+var DeviceManager = function(options) {
+  var self = this;
+
+  events.EventEmitter.call(this);
+  this.options = options || {};
+  this.readers = {};
+  this.retries = {};
+  this.running = false;
+  this.stopping = false;
+
+  this.monitor = new nfc.DeviceMonitor();
+  this.monitor.on('attached', function(device) {
+    self.emit('attached', device);
+    if (self.options.autoStart !== false) self.startReader(device.deviceID);
+  }).on('detached', function(device) {
+    var reader = self.readers[device.deviceID];
+
+    clearTimeout(self.retries[device.deviceID]);
+    delete self.retries[device.deviceID];
+    delete self.readers[device.deviceID];
+    if (reader) reader.stop();
+    self.emit('detached', device);
+  }).on('stopped', function() {
+    self.stopping = false;
+  });
+};
+inherits(DeviceManager, events.EventEmitter);
+
+DeviceManager.prototype.start = function() {
+  var self = this;
+
+  if (this.running) return this;
+  this.running = true;
+  if (this.stopping) {
+    this.monitor.once('stopped', function() { if (self.running) self.monitor.start({ interval: self.options.interval }); });
+  } else {
+    this.monitor.start({ interval: this.options.interval });
   }
+  return this;
+};
+
+DeviceManager.prototype.stop = function() {
+  var deviceID, pending = [];
+
+  this.running = false;
+  if (this.monitor.stop()) this.stopping = true;
+  for (deviceID in this.retries) clearTimeout(this.retries[deviceID]);
+  this.retries = {};
+  for (deviceID in this.readers) pending.push(this.readers[deviceID].stop());
 
-  return results;
+  if (typeof Promise !== 'function') return this;
+  return Promise.all(pending);
 };
 
-exports.nfc.scan = function() {
-  var device, devices, i, info, j, k, kv, mod, mods, prop, props, protocol, results, speeds, v, x;
+DeviceManager.prototype.devices = function() {
+  return this.monitor.devices();
+};
 
-  results = {};
+DeviceManager.prototype.reader = function(deviceID) {
+  return this.readers[deviceID];
+};
 
-  devices = nfc.scan();
-  for (device in devices) if (devices.hasOwnProperty(device)) {
-    props = devices[device].info.split('\n');
-    info = {};
-    for (i = 0; i < props.length; i++) {
-      prop = props[i].trim();
-      if (prop === '') continue;
+// 'reader' is emitted once per device, before its first start, so listeners see every read.
+DeviceManager.prototype.startReader = function(deviceID) {
+  var self = this, reader = this.readers[deviceID];
 
-      x = prop.indexOf(':');
-      if (x < 1) {
-        info[i] = prop;
-        continue;
-      }
+  if (!reader) {
+    reader = this.readers[deviceID] = new nfc.NFC();
+    reader.on('stopped', function(err) {
+      if (err && self.running && self.readers[deviceID] === reader) self.retry(deviceID);
+    });
+    this.emit('reader', reader, deviceID);
+  }
 
-      k = prop.substring(0, x);
-      v = prop.substring(x + 1).trim();
-      if (v.indexOf(')') === -1) {
-        info[k] = v;
-        continue;
-      }
+  try {
+    reader.start(deviceID, this.options.start || {});
+  } catch (err) {
+    this.retry(deviceID);
+  }
+  return reader;
+};
 
-      kv = v.split('), ');
-      mods = {};
-      for (j = 0; j < kv.length; j++) {
-        mod = kv[j].trim();
-        if (mod === '') continue;
-
-        x = mod.indexOf(' (');
-        if (x < 1) {
-          mods[j] = mod;
-          continue;
-        }
-        protocol = mod.substring(0, x);
-        speeds = mod.substring(x + 2).trim();
-        if (speeds.indexOf(')') === (speeds.length - 1)) speeds = speeds.substring(0, speeds.length - 1);
-        mods[protocol] = speeds.split(', ');
-      }
+DeviceManager.prototype.retry = function(deviceID) {
+  var self = this;
+
+  if (this.retries[deviceID]) return;
+  this.retries[deviceID] = setTimeout(function() {
+    delete self.retries[deviceID];
+    if (self.running && self.readers[deviceID]) self.startReader(deviceID);
+  }, this.options.retryInterval || 100);
+};
+
+// Journal records in order from a position (from) or a time (since), in batches of batchSize. With follow
+// the stream keeps polling every interval ms for new records instead of ending.
+var createJournalStream = function(dir, options) {
+  options = options || {};
+
+  var position = options.from || 0, timer = null;
+  var records = new stream.Readable({ objectMode: true, read: function() { pull(); } });
 
-      info[k] = mods;
+  var pull = function() {
+    var result;
+
+    timer = null;
+    try {
+      result = nfc.readJournal(dir, { from: position, since: options.since, limit: options.batchSize || 256 });
+    } catch (err) {
+      return records.emit('error', err);
     }
+    position = result.next;
 
-    results[device] = { name: devices[device].name, info: info };
-  }
+    if (!result.records.length) {
+      if (options.follow) timer = setTimeout(pull, options.interval || 250);
+      else records.push(null);
+      return;
+    }
+    result.records.forEach(function(record) { records.push(record); });
+  };
 
-  return results;
+  records.on('close', function() { clearTimeout(timer); });
+  return records;
 };
+
+exports.nfc = { version             : nfc.version
+              , NFC                 : nfc.NFC
+              , DeviceManager       : DeviceManager
+              , scan                : nfc.scan
+              , exportKeyCache      : nfc.exportKeyCache
+              , importKeyCache      : nfc.importKeyCache
+              , parse               : nfc.parse
+              , readJournal         : nfc.readJournal
+              , createJournalStream : createJournalStream
+              };
@@ -0,0 +1,112 @@
+#include <string.h>
+#include "device_info.h"
+
+static std::string Trim(const std::string &text) {
+    size_t first = text.find_first_not_of(" \t\r\n"), last = text.find_last_not_of(" \t\r\n");
+    return first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+}
+
+// Splits on every occurrence of separator, like String.prototype.split.
+static void Split(const std::string &text, const char *separator, std::vector<std::string> &parts) {
+    size_t start = 0, at, len = strlen(separator);
+    while ((at = text.find(separator, start)) != std::string::npos) {
+        parts.push_back(text.substr(start, at - start));
+        start = at + len;
+    }
+    parts.push_back(text.substr(start));
+}
+
+void DeviceInfo::Parse(const char *info) {
+    std::vector<std::string> rows;
+
+    raw = info;
+    lines.clear();
+    Split(raw, "\n", rows);
+    for (size_t i = 0; i < rows.size(); i++) {
+        std::string row = Trim(rows[i]);
+        if (row.empty()) continue;
+
+        DeviceInfoLine line;
+        line.index = i;
+        line.has_modulations = false;
+
+        size_t x = row.find(':');
+        if (x == std::string::npos || x < 1) {
+            line.value = row;
+            lines.push_back(line);
+            continue;
+        }
+
+        line.key = row.substr(0, x);
+        line.value = Trim(row.substr(x + 1));
+        if (line.value.find(')') == std::string::npos) {
+            lines.push_back(line);
+            continue;
+        }
+
+        std::vector<std::string> mods;
+        Split(line.value, "), ", mods);
+        line.has_modulations = true;
+        for (size_t j = 0; j < mods.size(); j++) {
+            std::string mod = Trim(mods[j]);
+            if (mod.empty()) continue;
+
+            DeviceInfoLine::Modulation modulation;
+            modulation.index = j;
+            x = mod.find(" (");
+            if (x == std::string::npos || x < 1) {
+                modulation.speeds.push_back(mod);
+            } else {
+                modulation.protocol = mod.substr(0, x);
+                std::string speeds = Trim(mod.substr(x + 2));
+                if (!speeds.empty() && speeds[speeds.size() - 1] == ')') speeds.erase(speeds.size() - 1);
+                Split(speeds, ", ", modulation.speeds);
+            }
+            line.modulations.push_back(modulation);
+        }
+        lines.push_back(line);
+    }
+}
+
+DeviceCache::DeviceCache() {
+    uv_mutex_init(&mutex);
+}
+
+DeviceCache::~DeviceCache() {
+    uv_mutex_destroy(&mutex);
+}
+
+bool DeviceCache::Lookup(const std::string &connstring, DeviceInfo &info) {
+    uv_mutex_lock(&mutex);
+    std::map<std::string, DeviceInfo>::iterator it = entries.find(connstring);
+    bool found = it != entries.end();
+    if (found) info = it->second;
+    uv_mutex_unlock(&mutex);
+    return found;
+}
+
+void DeviceCache::Store(const DeviceInfo &info) {
+    uv_mutex_lock(&mutex);
+    entries[info.connstring] = info;
+    uv_mutex_unlock(&mutex);
+}
+
+bool DeviceCache::Refresh(const std::vector<std::string> &connstrings, const std::set<std::string> &keep) {
+    uv_mutex_lock(&mutex);
+    bool changed = connstrings != listed;
+    listed = connstrings;
+    uv_mutex_unlock(&mutex);
+
+    if (changed) Clear(keep);
+    return changed;
+}
+
+void DeviceCache::Clear(const std::set<std::string> &keep) {
+    uv_mutex_lock(&mutex);
+    std::map<std::string, DeviceInfo>::iterator it = entries.begin();
+    while (it != entries.end()) {
+        if (keep.count(it->first)) it++;
+        else entries.erase(it++);
+    }
+    uv_mutex_unlock(&mutex);
+}
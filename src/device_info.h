@@ -0,0 +1,64 @@
+#ifndef _NFC_DEVICE_INFO_H_
+#  define _NFC_DEVICE_INFO_H_
+
+#  include <stddef.h>
+#  include <map>
+#  include <set>
+#  include <string>
+#  include <utility>
+#  include <vector>
+#  include <uv.h>
+
+/**
+ * What nfc_device_get_information_about reports, split into lines of "key: value".
+ * Values listing modulations, e.g. "ISO/IEC 14443A (106 kbps), FeliCa (424 kbps, 212 kbps)",
+ * are split into protocol and speeds. Lines and modulations that don't follow the
+ * pattern keep their position (index) instead of a key.
+ */
+struct DeviceInfoLine {
+    size_t                  index;
+    std::string             key;        // empty for positional lines
+    std::string             value;      // when there are no modulations
+    bool                    has_modulations;
+
+    struct Modulation {
+        size_t                   index;
+        std::string              protocol;  // empty for positional entries, text is in speeds[0]
+        std::vector<std::string> speeds;
+    };
+    std::vector<Modulation> modulations;
+};
+
+struct DeviceInfo {
+    std::string                 connstring;
+    std::string                 name;
+    std::string                 raw;
+    std::vector<DeviceInfoLine> lines;
+    bool                        ok;         // false when the device could not be opened
+
+    void Parse(const char *info);
+};
+
+/**
+ * Device info by connstring, shared by scan() and start(). When the list of
+ * attached devices changes, entries of devices that are not kept open by a
+ * reader are dropped, so replugged devices are probed again.
+ */
+class DeviceCache {
+  public:
+    DeviceCache();
+    ~DeviceCache();
+
+    bool Lookup(const std::string &connstring, DeviceInfo &info);
+    void Store(const DeviceInfo &info);
+    // Returns true when connstrings differs from the previous listing.
+    bool Refresh(const std::vector<std::string> &connstrings, const std::set<std::string> &keep);
+    void Clear(const std::set<std::string> &keep);
+
+  private:
+    uv_mutex_t                          mutex;
+    std::vector<std::string>            listed;
+    std::map<std::string, DeviceInfo>   entries;
+};
+
+#endif // _NFC_DEVICE_INFO_H_
@@ -0,0 +1,405 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <map>
+#include "journal.h"
+
+// segment layout: a 64 byte header { "NFCJ", u32 version, u32 sequence, u32 0, u64 size, u64 created_us }
+// followed by records, all little endian. A record is 8 byte aligned:
+//
+//    0 u32 size (written last, 0 ends the segment)   4 u32 crc32 of bytes 8 to size
+//    8 u64 time_us     16 i64 read_us     24 i64 probe_us     32 i32 type     36 i32 frames
+//   40 i32 auth_attempts     44 u32 data_size     48 u32 offset     52 u16 device_len
+//   54 u16 error_len     56 u8 uid_len     57 u8 tag_len     58 u8 atqa[2]     60 u8 sak
+//   64 uid, device ID, tag, error, data
+#define JOURNAL_HEADER 64
+#define RECORD_HEADER 64
+
+static const uint8_t magic[4] = { 'N', 'F', 'C', 'J' };
+
+static uv_once_t registry_once = UV_ONCE_INIT;
+static uv_mutex_t registry_mutex;
+static std::map<std::string, Journal*> registry;
+
+static void InitRegistry() {
+    uv_mutex_init(&registry_mutex);
+}
+
+static void PutU16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+static void PutU32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (value >> (8 * i)) & 0xff;
+}
+
+static void PutU64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = (value >> (8 * i)) & 0xff;
+}
+
+static uint16_t GetU16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t GetU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t GetU64(const uint8_t *p) {
+    return GetU32(p) | ((uint64_t) GetU32(p + 4) << 32);
+}
+
+static uint32_t Crc32(const uint8_t *data, size_t len) {
+    static struct Table {
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+        uint32_t entries[256];
+    } table;
+
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++) crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+static uint64_t Now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000 * 1000 + tv.tv_usec;
+}
+
+// macOS has no posix_fallocate, F_PREALLOCATE reserves the blocks and ftruncate sets the size.
+static bool Preallocate(int fd, size_t size) {
+#ifdef __APPLE__
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t) size, 0 };
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) return false;
+    return ftruncate(fd, size) == 0;
+#else
+    return posix_fallocate(fd, 0, size) == 0;
+#endif
+}
+
+static std::string SegmentPath(const std::string &dir, uint32_t sequence) {
+    char name[32];
+    snprintf(name, sizeof name, "/journal-%010u.seg", sequence);
+    return dir + name;
+}
+
+// Sequence numbers of the segments in dir, oldest first.
+static bool ListSegments(const std::string &dir, std::vector<uint32_t> &sequences, std::string &error) {
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        error = dir + ": " + strerror(errno);
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        unsigned int sequence;
+        char tail[8];
+        if (sscanf(entry->d_name, "journal-%10u.%7s", &sequence, tail) == 2 && strcmp(tail, "seg") == 0) {
+            sequences.push_back(sequence);
+        }
+    }
+    closedir(d);
+    std::sort(sequences.begin(), sequences.end());
+    return true;
+}
+
+// Size of the complete record at p, 0 when there is none (the end of the segment, or a torn write).
+static size_t RecordSize(const uint8_t *p, size_t available) {
+    if (available < RECORD_HEADER) return 0;
+    uint32_t size = GetU32(p);
+    if (size < RECORD_HEADER || size % 8 || size > available) return 0;
+    return Crc32(p + 8, size - 8) == GetU32(p + 4) ? size : 0;
+}
+
+static void Decode(const uint8_t *p, JournalEntry &entry) {
+    entry.time_us = GetU64(p + 8);
+    entry.read_us = (int64_t) GetU64(p + 16);
+    entry.probe_us = (int64_t) GetU64(p + 24);
+    entry.type = (int32_t) GetU32(p + 32);
+    entry.frames = (int32_t) GetU32(p + 36);
+    entry.auth_attempts = (int32_t) GetU32(p + 40);
+    entry.offset = GetU32(p + 48);
+    entry.atqa[0] = p[58];
+    entry.atqa[1] = p[59];
+    entry.sak = p[60];
+
+    const uint8_t *field = p + RECORD_HEADER;
+    entry.uid.assign(field, field + p[56]);
+    field += p[56];
+    entry.device_id.assign((const char *) field, GetU16(p + 52));
+    field += GetU16(p + 52);
+    entry.tag.assign((const char *) field, p[57]);
+    field += p[57];
+    entry.error.assign((const char *) field, GetU16(p + 54));
+    field += GetU16(p + 54);
+    entry.data.assign(field, field + GetU32(p + 44));
+}
+
+Journal::Journal(const std::string &dir, size_t segment_size, size_t segments)
+    : dir(dir), segment_size(segment_size), segments(segments), refs(1), sequence(0), base(NULL), mapped(0),
+      position(JOURNAL_HEADER), fd(-1) {
+    uv_mutex_init(&mutex);
+}
+
+Journal::~Journal() {
+    Unmap();
+    uv_mutex_destroy(&mutex);
+}
+
+Journal *Journal::Acquire(const std::string &dir, size_t segment_size, size_t segments, std::string &error) {
+    uv_once(&registry_once, InitRegistry);
+
+    uv_mutex_lock(&registry_mutex);
+    std::map<std::string, Journal*>::iterator it = registry.find(dir);
+    if (it != registry.end()) {
+        it->second->refs++;
+        uv_mutex_unlock(&registry_mutex);
+        return it->second;
+    }
+
+    Journal *journal = new Journal(dir, segment_size, segments);
+    if (!journal->Open(error)) {
+        delete journal;
+        journal = NULL;
+    } else {
+        registry[dir] = journal;
+    }
+    uv_mutex_unlock(&registry_mutex);
+    return journal;
+}
+
+void Journal::Release(Journal *journal) {
+    uv_mutex_lock(&registry_mutex);
+    if (--journal->refs == 0) {
+        registry.erase(journal->dir);
+        delete journal;
+    }
+    uv_mutex_unlock(&registry_mutex);
+}
+
+// Continues the newest segment after its last complete record, or starts the first one.
+bool Journal::Open(std::string &error) {
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        error = dir + ": " + strerror(errno);
+        return false;
+    }
+
+    std::vector<uint32_t> sequences;
+    if (!ListSegments(dir, sequences, error)) return false;
+
+    if (!sequences.empty() && Map(sequences.back(), false)) {
+        sequence = sequences.back();
+        size_t size;
+        while ((size = RecordSize(base + position, mapped - position)) > 0) position += size;
+        memset(base + position, 0, mapped - position);     //what a torn write left behind
+        return true;
+    }
+
+    uint32_t first = sequences.empty() ? 0 : sequences.back() + 1;
+    if (!Map(first, true)) {
+        error = SegmentPath(dir, first) + ": " + strerror(errno);
+        return false;
+    }
+    sequence = first;
+    return true;
+}
+
+// Segments are allocated up front, so a full disk fails here instead of faulting a write to the mapping.
+bool Journal::Map(uint32_t sequence, bool create) {
+    std::string path = SegmentPath(dir, sequence);
+    int fd = open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0666);
+    if (fd < 0) return false;
+
+    size_t size = segment_size;
+    struct stat st;
+    if (!create) {
+        if (fstat(fd, &st) != 0 || st.st_size < JOURNAL_HEADER + RECORD_HEADER) {
+            close(fd);
+            return false;
+        }
+        size = st.st_size;
+    } else if (!Preallocate(fd, size)) {
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    uint8_t *header = (uint8_t *) mapping;
+    if (create) {
+        memcpy(header, magic, sizeof magic);
+        PutU32(header + 4, 1);
+        PutU32(header + 8, sequence);
+        PutU64(header + 16, size);
+        PutU64(header + 24, Now());
+    } else if (memcmp(header, magic, sizeof magic) != 0) {
+        munmap(mapping, size);
+        close(fd);
+        return false;
+    }
+
+    this->fd = fd;
+    base = header;
+    mapped = size;
+    position = JOURNAL_HEADER;
+    return true;
+}
+
+void Journal::Unmap() {
+    if (base) munmap(base, mapped);
+    if (fd >= 0) close(fd);
+    base = NULL;
+    fd = -1;
+}
+
+// Under the lock. The segment falling out of the kept window is deleted once its successor exists.
+bool Journal::Rotate() {
+    Unmap();
+    if (!Map(sequence + 1, true)) return false;
+
+    sequence++;
+    if (sequence >= segments) unlink(SegmentPath(dir, sequence - segments).c_str());
+    return true;
+}
+
+int64_t Journal::Append(JournalRecord &record) {
+    size_t uid_len = std::min(record.uid_len, (size_t) 0xff);
+    size_t device_len = record.device_id ? std::min(strlen(record.device_id), (size_t) 0xffff) : 0;
+    size_t tag_len = record.tag ? std::min(strlen(record.tag), (size_t) 0xff) : 0;
+    size_t error_len = record.error ? std::min(strlen(record.error), (size_t) 0xffff) : 0;
+    size_t length = RECORD_HEADER + uid_len + device_len + tag_len + error_len + record.data_size;
+    size_t size = (length + 7) & ~(size_t) 7;
+
+    record.time_us = Now();
+    if (size > segment_size - JOURNAL_HEADER) return -1;
+
+    uv_mutex_lock(&mutex);
+    if ((!base || position + size > mapped) && !Rotate()) {
+        uv_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    uint8_t *p = base + position;
+    PutU64(p + 8, record.time_us);
+    PutU64(p + 16, (uint64_t) record.read_us);
+    PutU64(p + 24, (uint64_t) record.probe_us);
+    PutU32(p + 32, (uint32_t) record.type);
+    PutU32(p + 36, (uint32_t) record.frames);
+    PutU32(p + 40, (uint32_t) record.auth_attempts);
+    PutU32(p + 44, (uint32_t) record.data_size);
+    PutU32(p + 48, (uint32_t) record.offset);
+    PutU16(p + 52, device_len);
+    PutU16(p + 54, error_len);
+    p[56] = uid_len;
+    p[57] = tag_len;
+    p[58] = record.atqa[0];
+    p[59] = record.atqa[1];
+    p[60] = record.sak;
+    p[61] = p[62] = p[63] = 0;
+
+    uint8_t *field = p + RECORD_HEADER;
+    memcpy(field, record.uid, uid_len);
+    field += uid_len;
+    memcpy(field, record.device_id, device_len);
+    field += device_len;
+    memcpy(field, record.tag, tag_len);
+    field += tag_len;
+    memcpy(field, record.error, error_len);
+    field += error_len;
+    if (record.data_size) memcpy(field, record.data, record.data_size);
+    memset(p + length, 0, size - length);
+    PutU32(p + 4, Crc32(p + 8, size - 8));
+
+    // the size makes the record visible, to readers and after a crash, so it goes in last.
+    uint8_t le[4];
+    uint32_t word;
+    PutU32(le, size);
+    memcpy(&word, le, sizeof word);
+    __atomic_store_n((uint32_t *) p, word, __ATOMIC_RELEASE);
+
+    int64_t at = (int64_t) sequence << 32 | position;
+    position += size;
+    uv_mutex_unlock(&mutex);
+    return at;
+}
+
+bool Journal::Read(const std::string &dir, uint64_t position, uint64_t since_us, size_t limit,
+                   std::vector<JournalEntry> &entries, uint64_t *next, std::string &error) {
+    std::vector<uint32_t> sequences;
+    if (!ListSegments(dir, sequences, error)) return false;
+
+    *next = position;
+    size_t i = 0, offset = JOURNAL_HEADER;
+    if (position) {
+        uint32_t wanted = position >> 32;
+        while (i < sequences.size() && sequences[i] < wanted) i++;
+        if (i < sequences.size() && sequences[i] == wanted) offset = position & 0xffffffff;
+    }
+
+    for (; i < sequences.size() && entries.size() < limit; i++, offset = JOURNAL_HEADER) {
+        int fd = open(SegmentPath(dir, sequences[i]).c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0) continue;   //deleted by rotation meanwhile
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < JOURNAL_HEADER) {
+            close(fd);
+            continue;
+        }
+
+        size_t size = st.st_size;
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) continue;
+
+        const uint8_t *base = (const uint8_t *) mapping;
+        bool valid = memcmp(base, magic, sizeof magic) == 0;
+
+        // a whole segment older than since is skipped when the next one starts before it too.
+        bool skip = valid && since_us && i + 1 < sequences.size() && offset == JOURNAL_HEADER;
+        if (skip) {
+            int next_fd = open(SegmentPath(dir, sequences[i + 1]).c_str(), O_RDONLY);
+            uint8_t header[JOURNAL_HEADER];
+            skip = next_fd >= 0 && pread(next_fd, header, sizeof header, 0) == (ssize_t) sizeof header &&
+                   memcmp(header, magic, sizeof magic) == 0 && GetU64(header + 24) <= since_us;
+            if (next_fd >= 0) close(next_fd);
+        }
+
+        while (valid && !skip && entries.size() < limit && offset < size) {
+            size_t record_size = RecordSize(base + offset, size - offset);
+            if (record_size == 0) break;
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (GetU64(base + offset + 8) >= since_us) {
+                entries.push_back(JournalEntry());
+                entries.back().position = (uint64_t) sequences[i] << 32 | offset;
+                Decode(base + offset, entries.back());
+            }
+            offset += record_size;
+        }
+        munmap(mapping, size);
+
+        *next = (uint64_t) sequences[i] << 32 | offset;
+        if (entries.size() >= limit) break;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef _NFC_JOURNAL_H_
+#  define _NFC_JOURNAL_H_
+
+#  include <stdint.h>
+#  include <stddef.h>
+#  include <string>
+#  include <vector>
+#  include <uv.h>
+
+/**
+ * What a read leaves in the journal. Pointers only have to live for the Append call.
+ */
+struct JournalRecord {
+    uint64_t        time_us;        // wall clock, filled in by Append
+    const char      *device_id;
+    const uint8_t   *uid;
+    size_t          uid_len;
+    uint8_t         atqa[2];        // ISO14443A only, zero otherwise
+    uint8_t         sak;
+    int32_t         type;
+    const char      *tag;           // NULL when not known
+    const char      *error;         // NULL when the read succeeded
+    int64_t         read_us;        // -1 when not measured
+    int64_t         probe_us;
+    int32_t         frames;
+    int32_t         auth_attempts;  // -1 when not MIFARE Classic
+    const uint8_t   *data;
+    size_t          data_size;
+    size_t          offset;         // where the tag data starts in data
+};
+
+// A record read back, owning its bytes.
+struct JournalEntry {
+    uint64_t                position;   // segment << 32 | byte offset in the segment
+    uint64_t                time_us;
+    std::string             device_id;
+    std::vector<uint8_t>    uid;
+    uint8_t                 atqa[2];
+    uint8_t                 sak;
+    int32_t                 type;
+    std::string             tag;
+    std::string             error;
+    int64_t                 read_us;
+    int64_t                 probe_us;
+    int32_t                 frames;
+    int32_t                 auth_attempts;
+    std::vector<uint8_t>    data;
+    uint32_t                offset;
+};
+
+/**
+ * Append-only log of reads in a directory of fixed size, memory-mapped segment files
+ * (journal-<n>.seg). Records are written straight into the mapping, their length last,
+ * so a record is either complete or ends the segment; everything appended is in the page
+ * cache and survives the process crashing. When a segment is full the next one is
+ * created and the oldest are deleted beyond the number kept.
+ *
+ * Readers of the same directory share one journal, Append takes the lock.
+ */
+class Journal {
+  public:
+    // Opens (or creates) the journal in dir, shared with every other reader using it.
+    // Segment size and count are taken from the first to open it. NULL with error set on failure.
+    static Journal *Acquire(const std::string &dir, size_t segment_size, size_t segments, std::string &error);
+    static void Release(Journal *journal);
+
+    // Position of the record, -1 when it could not be written (e.g. the disk is full).
+    int64_t Append(JournalRecord &record);
+
+    // Up to limit records from position on (0 is the oldest kept), skipping those before
+    // since_us. next is where to continue. false with error set when dir is not a journal.
+    static bool Read(const std::string &dir, uint64_t position, uint64_t since_us, size_t limit,
+                     std::vector<JournalEntry> &entries, uint64_t *next, std::string &error);
+
+  private:
+    Journal(const std::string &dir, size_t segment_size, size_t segments);
+    ~Journal();
+
+    bool Open(std::string &error);
+    bool Map(uint32_t sequence, bool create);
+    void Unmap();
+    bool Rotate();
+
+    std::string     dir;
+    size_t          segment_size;
+    size_t          segments;       // kept on disk, the current one included
+    size_t          refs;           // under the registry lock
+    uv_mutex_t      mutex;
+    uint32_t        sequence;       // of the mapped segment
+    uint8_t         *base;          // NULL after a segment could not be created, Append retries
+    size_t          mapped;         // size of the mapped segment
+    size_t          position;       // next free byte in the mapped segment
+    int             fd;
+};
+
+#endif // _NFC_JOURNAL_H_
@@ -0,0 +1,181 @@
+#include <string.h>
+#include "key_cache.h"
+
+// snapshot layout: "NKC1", u32 entries, u32 counters (little endian), then
+// entries as { u8 idLen, id (uid + sector), u8 type, key[6] } oldest first
+// and counters as { key[6], u32 successes }.
+static const uint8_t magic[4] = { 'N', 'K', 'C', '1' };
+
+static void PutU32(std::vector<uint8_t> &out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back((value >> (8 * i)) & 0xff);
+}
+
+static uint32_t GetU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+KeyCache::KeyCache(size_t capacity) : capacity(capacity) {
+    uv_mutex_init(&mutex);
+}
+
+KeyCache::~KeyCache() {
+    uv_mutex_destroy(&mutex);
+}
+
+std::string KeyCache::Id(const uint8_t *uid, size_t uid_len, uint8_t sector) {
+    std::string id((const char *) uid, uid_len);
+    id.push_back((char) sector);
+    return id;
+}
+
+uint64_t KeyCache::Key48(const uint8_t key[6]) {
+    uint64_t value = 0;
+    for (int i = 0; i < 6; i++) value = (value << 8) | key[i];
+    return value;
+}
+
+void KeyCache::Insert(const std::string &id, uint8_t type, const uint8_t key[6]) {
+    std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = index.find(id);
+    if (it != index.end()) {
+        // a card seen before, refresh in place rather than reallocating the node.
+        lru.splice(lru.begin(), lru, it->second);
+        it->second->type = type;
+        memcpy(it->second->key, key, sizeof it->second->key);
+        return;
+    }
+
+    Entry entry;
+    entry.id = id;
+    entry.type = type;
+    memcpy(entry.key, key, sizeof entry.key);
+    lru.push_front(entry);
+    index[id] = lru.begin();
+
+    while (lru.size() > capacity) {
+        index.erase(lru.back().id);
+        lru.pop_back();
+    }
+}
+
+bool KeyCache::Lookup(const uint8_t *uid, size_t uid_len, uint8_t sector, uint8_t *type, uint8_t key[6]) {
+    bool found = false;
+
+    uv_mutex_lock(&mutex);
+    std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = index.find(Id(uid, uid_len, sector));
+    if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        *type = it->second->type;
+        memcpy(key, it->second->key, 6);
+        found = true;
+    }
+    uv_mutex_unlock(&mutex);
+
+    return found;
+}
+
+void KeyCache::Store(const uint8_t *uid, size_t uid_len, uint8_t sector, uint8_t type, const uint8_t key[6]) {
+    uv_mutex_lock(&mutex);
+    Insert(Id(uid, uid_len, sector), type, key);
+    uv_mutex_unlock(&mutex);
+}
+
+void KeyCache::Forget(const uint8_t *uid, size_t uid_len, uint8_t sector) {
+    uv_mutex_lock(&mutex);
+    std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = index.find(Id(uid, uid_len, sector));
+    if (it != index.end()) {
+        lru.erase(it->second);
+        index.erase(it);
+    }
+    uv_mutex_unlock(&mutex);
+}
+
+void KeyCache::RecordSuccess(const uint8_t key[6]) {
+    uv_mutex_lock(&mutex);
+    successes[Key48(key)]++;
+    uv_mutex_unlock(&mutex);
+}
+
+void KeyCache::Order(const uint8_t *keys, size_t num_keys, size_t *order) {
+    for (size_t i = 0; i < num_keys; i++) order[i] = i;
+    if (num_keys == 0) return;
+
+    uv_mutex_lock(&mutex);
+    counts.assign(num_keys, 0);
+    for (size_t i = 0; i < num_keys; i++) {
+        std::map<uint64_t, uint32_t>::iterator it = successes.find(Key48(keys + i * 6));
+        if (it != successes.end()) counts[i] = it->second;
+    }
+
+    // stable insertion sort, dictionaries are short and std::stable_sort would allocate.
+    for (size_t i = 1; i < num_keys; i++) {
+        size_t j, index = order[i];
+        for (j = i; j > 0 && counts[order[j - 1]] < counts[index]; j--) order[j] = order[j - 1];
+        order[j] = index;
+    }
+    uv_mutex_unlock(&mutex);
+}
+
+void KeyCache::Export(std::vector<uint8_t> &out) {
+    uv_mutex_lock(&mutex);
+    out.insert(out.end(), magic, magic + sizeof magic);
+    PutU32(out, lru.size());
+    PutU32(out, successes.size());
+
+    for (std::list<Entry>::reverse_iterator it = lru.rbegin(); it != lru.rend(); it++) {
+        out.push_back(it->id.size());
+        out.insert(out.end(), it->id.begin(), it->id.end());
+        out.push_back(it->type);
+        out.insert(out.end(), it->key, it->key + sizeof it->key);
+    }
+    for (std::map<uint64_t, uint32_t>::iterator it = successes.begin(); it != successes.end(); it++) {
+        for (int i = 5; i >= 0; i--) out.push_back((it->first >> (8 * i)) & 0xff);
+        PutU32(out, it->second);
+    }
+    uv_mutex_unlock(&mutex);
+}
+
+bool KeyCache::Import(const uint8_t *data, size_t size) {
+    const uint8_t *p = data, *end = data + size;
+
+    if (size < 12 || memcmp(p, magic, sizeof magic) != 0) return false;
+    uint32_t num_entries = GetU32(p + 4), num_counters = GetU32(p + 8);
+    p += 12;
+
+    // validate everything before touching the cache.
+    const uint8_t *entries = p;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        if (p >= end || p[0] == 0 || (size_t) (end - p) < 1u + p[0] + 1 + 6) return false;
+        p += 1 + p[0] + 1 + 6;
+    }
+    if ((size_t) (end - p) != (size_t) num_counters * 10) return false;
+
+    uv_mutex_lock(&mutex);
+    for (p = entries; num_entries > 0; num_entries--) {
+        std::string id((const char *) p + 1, p[0]);
+        Insert(id, p[1 + p[0]], p + 2 + p[0]);
+        p += 1 + p[0] + 1 + 6;
+    }
+    for (; num_counters > 0; num_counters--, p += 10) {
+        uint32_t &count = successes[Key48(p)];
+        uint32_t value = GetU32(p + 6);
+        if (count < value) count = value;
+    }
+    uv_mutex_unlock(&mutex);
+
+    return true;
+}
+
+size_t KeyCache::Size() {
+    uv_mutex_lock(&mutex);
+    size_t size = lru.size();
+    uv_mutex_unlock(&mutex);
+    return size;
+}
+
+void KeyCache::Clear() {
+    uv_mutex_lock(&mutex);
+    lru.clear();
+    index.clear();
+    successes.clear();
+    uv_mutex_unlock(&mutex);
+}
@@ -0,0 +1,61 @@
+#ifndef _NFC_KEY_CACHE_H_
+#  define _NFC_KEY_CACHE_H_
+
+#  include <stdint.h>
+#  include <stddef.h>
+#  include <list>
+#  include <map>
+#  include <string>
+#  include <vector>
+#  include <unordered_map>
+#  include <uv.h>
+
+/**
+ * Remembers which MIFARE Classic key opened a sector of a given card, so the
+ * next tap of that card authenticates on the first attempt. Cards that are not
+ * cached yet fall back to trying keys in order of how often they have worked
+ * before in this deployment.
+ *
+ * Shared by all reader threads, every public method takes the lock.
+ */
+class KeyCache {
+  public:
+    explicit KeyCache(size_t capacity);
+    ~KeyCache();
+
+    // Looks up the key that last opened sector of uid, refreshing its LRU position.
+    bool Lookup(const uint8_t *uid, size_t uid_len, uint8_t sector, uint8_t *type, uint8_t key[6]);
+    void Store(const uint8_t *uid, size_t uid_len, uint8_t sector, uint8_t type, const uint8_t key[6]);
+    void Forget(const uint8_t *uid, size_t uid_len, uint8_t sector);
+
+    // Per-deployment success counters, used to order keys for unknown cards.
+    void RecordSuccess(const uint8_t key[6]);
+    void Order(const uint8_t *keys, size_t num_keys, size_t *order);
+
+    // Binary snapshot of entries and counters, Import merges into the current state.
+    void Export(std::vector<uint8_t> &out);
+    bool Import(const uint8_t *data, size_t size);
+
+    size_t Size();
+    void Clear();
+
+  private:
+    struct Entry {
+        std::string id;
+        uint8_t     type;
+        uint8_t     key[6];
+    };
+
+    static std::string Id(const uint8_t *uid, size_t uid_len, uint8_t sector);
+    static uint64_t Key48(const uint8_t key[6]);
+    void Insert(const std::string &id, uint8_t type, const uint8_t key[6]);
+
+    size_t                                                   capacity;
+    uv_mutex_t                                               mutex;
+    std::list<Entry>                                         lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::map<uint64_t, uint32_t>                             successes;
+    std::vector<uint32_t>                                    counts;    // Order() scratch, under the lock
+};
+
+#endif // _NFC_KEY_CACHE_H_
@@ -0,0 +1,96 @@
+#include "ndef.h"
+
+#define NDEF_MB 0x80
+#define NDEF_ME 0x40
+#define NDEF_CF 0x20
+#define NDEF_SR 0x10
+#define NDEF_IL 0x08
+#define NDEF_TNF_MASK 0x07
+
+void NdefParser::Clear() {
+    tlvs.clear();
+    records.clear();
+}
+
+void NdefParser::Parse(const uint8_t *data, size_t size) {
+    size_t i = 0;
+
+    Clear();
+    while (i < size) {
+        NdefTlv tlv = NdefTlv();
+        tlv.type = data[i++];
+        if (tlv.type == TLV_NULL) continue;
+        if (tlv.type == TLV_TERMINATOR || i >= size) {
+            tlvs.push_back(tlv);
+            break;
+        }
+
+        // one length byte, or 0xff followed by a 16 bit big endian length.
+        tlv.length = data[i++];
+        if (tlv.length == 0xff) {
+            if (i + 2 > size) break;
+            tlv.length = (data[i] << 8) | data[i + 1];
+            i += 2;
+        }
+        tlv.has_length = true;
+        tlv.value_offset = i;
+        if (tlv.length > 0 && tlv.length <= size - i) {
+            tlv.has_value = true;
+            if (tlv.type == TLV_NDEF) tlv.has_ndef = ParseMessage(data, i, i + tlv.length, tlv);
+        }
+        tlvs.push_back(tlv);
+        if (tlv.length > size - i) break;
+        i += tlv.length;
+    }
+}
+
+// Records up to the one flagged ME, chunks are reported as they are rather than joined.
+// A malformed message leaves no records behind.
+bool NdefParser::ParseMessage(const uint8_t *data, size_t i, size_t end, NdefTlv &tlv) {
+    size_t first = records.size();
+    bool ok = false, malformed = true;
+
+    while (i < end) {
+        NdefRecord record = NdefRecord();
+        uint8_t header = data[i++];
+        record.tnf = header & NDEF_TNF_MASK;
+        record.mb = (header & NDEF_MB) != 0;
+        record.me = (header & NDEF_ME) != 0;
+        record.cf = (header & NDEF_CF) != 0;
+        record.has_id = (header & NDEF_IL) != 0;
+
+        size_t fixed = 1 + ((header & NDEF_SR) ? 1 : 4) + (record.has_id ? 1 : 0);
+        if (fixed > end - i) break;
+        record.type_length = data[i++];
+        if (header & NDEF_SR) {
+            record.payload_length = data[i++];
+        } else {
+            record.payload_length = ((size_t) data[i] << 24) | (data[i + 1] << 16) | (data[i + 2] << 8) | data[i + 3];
+            i += 4;
+        }
+        if (record.has_id) record.id_length = data[i++];
+
+        if (record.type_length > end - i) break;
+        record.type_offset = i;
+        i += record.type_length;
+        if (record.id_length > end - i) break;
+        record.id_offset = i;
+        i += record.id_length;
+        if (record.payload_length > end - i) break;
+        record.payload_offset = i;
+        i += record.payload_length;
+
+        records.push_back(record);
+        if (record.me || i == end) {
+            // a message without ME still yields its records when they fill the TLV exactly.
+            malformed = false;
+            break;
+        }
+    }
+    ok = !malformed;
+    if (!ok) records.resize(first);
+
+    tlv.first_record = first;
+    tlv.num_records = records.size() - first;
+    return ok;
+}
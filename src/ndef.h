@@ -0,0 +1,46 @@
+#ifndef _NFC_NDEF_H_
+#  define _NFC_NDEF_H_
+
+#  include <stdint.h>
+#  include <stddef.h>
+#  include <vector>
+
+#  define TLV_NULL        0x00
+#  define TLV_NDEF        0x03
+#  define TLV_TERMINATOR  0xfe
+
+// Offsets are relative to the start of the parsed data.
+struct NdefRecord {
+    uint8_t tnf;
+    bool    mb, me, cf, has_id;
+    size_t  type_offset, type_length;
+    size_t  id_offset, id_length;
+    size_t  payload_offset, payload_length;
+};
+
+struct NdefTlv {
+    uint8_t type;
+    bool    has_length, has_value, has_ndef;
+    size_t  length, value_offset;
+    size_t  first_record, num_records;  // slice of NdefParser::records
+};
+
+/**
+ * Walks the NFC Forum TLV blocks of a tag's data area and the NDEF records inside
+ * NDEF message TLVs. Only offsets are recorded, so callers can hand out views of
+ * their own buffer instead of copies. Parse() clears without freeing, a parser
+ * that is reused stops allocating once it has grown to the largest message seen.
+ */
+class NdefParser {
+  public:
+    void Parse(const uint8_t *data, size_t size);
+    void Clear();
+
+    std::vector<NdefTlv>    tlvs;
+    std::vector<NdefRecord> records;
+
+  private:
+    bool ParseMessage(const uint8_t *data, size_t offset, size_t end, NdefTlv &tlv);
+};
+
+#endif // _NFC_NDEF_H_
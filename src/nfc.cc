@@ -2,9 +2,28 @@
 #include <unistd.h>
 #include <string.h>
 #include <err.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include <nfc/nfc.h>
 #include <nan.h>
 #include "mifare.h"
+#include "key_cache.h"
+#include "device_info.h"
+#include "journal.h"
+#include "ndef.h"
+#include "poll_scheduler.h"
+#include "pool.h"
+#include "stats.h"
+#include "tag_queue.h"
+#include "transport.h"
+
+// Per-environment cleanup, so readers started in a worker thread are closed when the worker exits.
+#define NFC_ENV_CLEANUP_HOOKS (NODE_MAJOR_VERSION > 10 || (NODE_MAJOR_VERSION == 10 && NODE_MINOR_VERSION >= 2))
 
 using namespace v8;
 
@@ -12,7 +31,7 @@ static const nfc_modulation nmMifare = {
   NMT_ISO14443A,
   NBR_106,
 };
-static uint8_t keys[] = {
+static const uint8_t keys[] = {
   0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
   0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7,
   0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5,
@@ -23,458 +42,3679 @@ static uint8_t keys[] = {
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0xab, 0xcd, 0xef, 0x12, 0x34, 0x56
 };
-static size_t num_keys = sizeof(keys) / 6;
+static const size_t num_keys = sizeof(keys) / 6;
+static KeyCache key_cache(4096);
+static DeviceCache device_cache;
+static PollScheduler *poll_scheduler = new PollScheduler();   //shared by every thread, never torn down
 
 
 namespace {
 
+    class NFCReader;
+
+    #define MAX_SECTOR_COUNT 40
+
+    // Parsed once at start(), so the read path never touches JS values.
+    struct KeyDictionary {
+        struct Hint {
+            uint8_t type;   // 0 when the sector has no hint
+            uint8_t key[6];
+        };
+
+        KeyDictionary() : keys(::keys, ::keys + sizeof ::keys), num_types(1) {
+            types[0] = MC_AUTH_B;
+            memset(hints, 0, sizeof hints);
+        }
+
+        size_t NumKeys() const { return keys.size() / 6; }
+        const uint8_t *Key(size_t index) const { return &keys[index * 6]; }
+        const Hint *SectorHint(uint8_t sector) const {
+            return (sector < MAX_SECTOR_COUNT && hints[sector].type) ? &hints[sector] : NULL;
+        }
+
+        static bool ParseType(Local<Value> value, uint8_t *type) {
+            Nan::Utf8String name(value);
+            if (strcmp(*name, "A") == 0) *type = MC_AUTH_A;
+            else if (strcmp(*name, "B") == 0) *type = MC_AUTH_B;
+            else return false;
+            return true;
+        }
+
+        const char *ParseKeys(Local<Value> value) {
+            if (!node::Buffer::HasInstance(value)) return "keys option is not a Buffer";
+            size_t size = node::Buffer::Length(value);
+            if (size == 0 || size % 6 != 0) return "keys option must hold one or more 6 byte keys";
+
+            const uint8_t *data = (const uint8_t *) node::Buffer::Data(value);
+            keys.assign(data, data + size);
+            return NULL;
+        }
+
+        const char *ParseKeyType(Local<Value> value) {
+            Nan::Utf8String name(value);
+            if (strcmp(*name, "A") == 0) {
+                types[0] = MC_AUTH_A;
+                num_types = 1;
+            } else if (strcmp(*name, "B") == 0) {
+                types[0] = MC_AUTH_B;
+                num_types = 1;
+            } else if (strcmp(*name, "AB") == 0) {
+                types[0] = MC_AUTH_A;
+                types[1] = MC_AUTH_B;
+                num_types = 2;
+            } else if (strcmp(*name, "BA") == 0) {
+                types[0] = MC_AUTH_B;
+                types[1] = MC_AUTH_A;
+                num_types = 2;
+            } else return "keyType option must be one of A, B, AB or BA";
+            return NULL;
+        }
+
+        // { <sector>: Buffer } or { <sector>: { key: Buffer, type: 'A' | 'B' } }
+        // Property names are canonical array indices ("0" to "39"), anything else is not a sector.
+        static bool ParseSector(Local<Value> name, uint32_t *sector) {
+            if (name->IsUint32()) {
+                *sector = Nan::To<uint32_t>(name).FromJust();
+                return *sector < MAX_SECTOR_COUNT;
+            }
+
+            Nan::Utf8String text(name);
+            size_t length = text.length();
+            if (length == 0 || length > 2 || (length > 1 && (*text)[0] == '0')) return false;
+            *sector = 0;
+            for (size_t i = 0; i < length; i++) {
+                if ((*text)[i] < '0' || (*text)[i] > '9') return false;
+                *sector = *sector * 10 + ((*text)[i] - '0');
+            }
+            return *sector < MAX_SECTOR_COUNT;
+        }
+
+        const char *ParseSectorKeys(Local<Value> value) {
+            if (!value->IsObject()) return "sectorKeys option is not an object";
+
+            Local<Object> object = value.As<Object>();
+            Local<Array> sectors = Nan::GetOwnPropertyNames(object).ToLocalChecked();
+            for (uint32_t i = 0; i < sectors->Length(); i++) {
+                Local<Value> name = Nan::Get(sectors, i).ToLocalChecked();
+                uint32_t sector;
+                if (!ParseSector(name, &sector)) return "sectorKeys option has an invalid sector number";
+
+                Local<Value> hint = Nan::Get(object, name).ToLocalChecked(), key = hint;
+                uint8_t type = types[0];
+                if (!node::Buffer::HasInstance(hint) && hint->IsObject()) {
+                    key = Nan::Get(hint.As<Object>(), Nan::New("key").ToLocalChecked()).ToLocalChecked();
+                    Local<Value> kind = Nan::Get(hint.As<Object>(), Nan::New("type").ToLocalChecked()).ToLocalChecked();
+                    if (!kind->IsUndefined() && !ParseType(kind, &type)) return "sectorKeys type must be A or B";
+                }
+                if (!node::Buffer::HasInstance(key) || node::Buffer::Length(key) != 6) return "sectorKeys must be 6 byte Buffers";
+
+                hints[sector].type = type;
+                memcpy(hints[sector].key, node::Buffer::Data(key), 6);
+            }
+            return NULL;
+        }
+
+        std::vector<uint8_t> keys;
+        uint8_t types[2];
+        size_t num_types;
+        Hint hints[MAX_SECTOR_COUNT];
+    };
+
+    // NFC Forum MIFARE Classic keys, the MAD sector and the NDEF sectors.
+    static const KeyDictionary::Hint mad_key = { MC_AUTH_A, { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5 } };
+    static const KeyDictionary::Hint ndef_key = { MC_AUTH_A, { 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7 } };
+
+    typedef enum {
+        READ_FULL,
+        READ_UID,
+        READ_NDEF,
+        READ_BLOCKS
+    } read_mode;
+
+    // What ReadTag fetches after anticollision: everything, nothing but the UID,
+    // the NDEF area, or a list of sectors and block (page on Ultralight) ranges.
+    struct ReadPlan {
+        ReadPlan() : mode(READ_FULL) {}
+
+        const char *Parse(Local<Value> value) {
+            if (!value->IsObject()) {
+                Nan::Utf8String name(value);
+                if (strcmp(*name, "full") == 0) mode = READ_FULL;
+                else if (strcmp(*name, "uid") == 0) mode = READ_UID;
+                else if (strcmp(*name, "ndef") == 0) mode = READ_NDEF;
+                else return "read option must be one of full, uid, ndef or an object";
+                return NULL;
+            }
+
+            mode = READ_BLOCKS;
+            Local<Value> list = Nan::Get(value.As<Object>(), Nan::New("sectors").ToLocalChecked()).ToLocalChecked();
+            if (!list->IsUndefined()) {
+                if (!list->IsArray()) return "read.sectors is not an array";
+                Local<Array> array = list.As<Array>();
+                for (uint32_t i = 0; i < array->Length(); i++) {
+                    Local<Value> sector = Nan::Get(array, i).ToLocalChecked();
+                    if (!sector->IsUint32() || Nan::To<uint32_t>(sector).FromJust() >= MAX_SECTOR_COUNT) return "read.sectors has an invalid sector number";
+                    sectors.push_back(Nan::To<uint32_t>(sector).FromJust());
+                }
+            }
+
+            list = Nan::Get(value.As<Object>(), Nan::New("blocks").ToLocalChecked()).ToLocalChecked();
+            if (!list->IsUndefined()) {
+                if (!list->IsArray()) return "read.blocks is not an array";
+                Local<Array> array = list.As<Array>();
+                for (uint32_t i = 0; i < array->Length(); i++) {
+                    Local<Value> range = Nan::Get(array, i).ToLocalChecked();
+                    uint32_t first, last;
+                    if (range->IsUint32()) {
+                        first = last = Nan::To<uint32_t>(range).FromJust();
+                    } else if (range->IsArray() && range.As<Array>()->Length() == 2
+                                 && Nan::Get(range.As<Array>(), 0).ToLocalChecked()->IsUint32() && Nan::Get(range.As<Array>(), 1).ToLocalChecked()->IsUint32()) {
+                        first = Nan::To<uint32_t>(Nan::Get(range.As<Array>(), 0).ToLocalChecked()).FromJust();
+                        last = Nan::To<uint32_t>(Nan::Get(range.As<Array>(), 1).ToLocalChecked()).FromJust();
+                    } else return "read.blocks entries must be a block number or a [first, last] pair";
+                    if (first > last) return "read.blocks has a range that ends before it starts";
+                    ranges.push_back(std::make_pair(first, last));
+                }
+            }
+            return NULL;
+        }
+
+        // Flags the planned blocks that exist on the card, sectors only apply to MIFARE Classic.
+        void Mark(bool classic, bool *wanted, size_t count) const {
+            size_t i, block;
+
+            if (mode == READ_FULL) {
+                for (block = 0; block < count; block++) wanted[block] = true;
+                return;
+            }
+            for (i = 0; classic && i < sectors.size(); i++) {
+                size_t first = sectors[i] < 32 ? sectors[i] * 4 : 128 + (sectors[i] - 32) * 16;
+                size_t size = sectors[i] < 32 ? 4 : 16;
+                for (block = first; block < first + size && block < count; block++) wanted[block] = true;
+            }
+            for (i = 0; i < ranges.size(); i++) {
+                for (block = ranges[i].first; block <= ranges[i].second && block < count; block++) wanted[block] = true;
+            }
+        }
+
+        read_mode mode;
+        std::vector<uint8_t> sectors;
+        std::vector<std::pair<uint32_t, uint32_t> > ranges;
+    };
+
+    struct NFCOptions {
+        NFCOptions() : queue_size(32), overflow(TQ_DROP_OLDEST), use_key_cache(true),
+                       presence(true), presence_interval(100), debounce(500), parse_ndef(false),
+                       modulations(1, nmMifare), poll_count(0xff), poll_period(2), timings(false), paused(false),
+                       inventory(false), journal_segment_size(16 * 1024 * 1024), journal_segments(8),
+                       polling(POLL_DEVICE), poll_interval(100), poll_max_interval(1000), poll_burst(2000), poll_spacing(10) {}
+
+        const char *Parse(Local<Object> options) {
+            Local<Value> value = Nan::Get(options, Nan::New("queueSize").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() == 0) return "queueSize option is not a positive integer";
+                queue_size = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("overflow").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                Nan::Utf8String policy(value);
+                if (strcmp(*policy, "drop-oldest") == 0) overflow = TQ_DROP_OLDEST;
+                else if (strcmp(*policy, "drop-newest") == 0) overflow = TQ_DROP_NEWEST;
+                else if (strcmp(*policy, "block") == 0) overflow = TQ_BLOCK;
+                else return "overflow option must be one of drop-oldest, drop-newest or block";
+            }
+
+            value = Nan::Get(options, Nan::New("keyCache").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) use_key_cache = Nan::To<bool>(value).FromJust();
+
+            const char *err = NULL;
+            value = Nan::Get(options, Nan::New("keys").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined() && (err = dictionary.ParseKeys(value)) != NULL) return err;
+
+            value = Nan::Get(options, Nan::New("keyType").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined() && (err = dictionary.ParseKeyType(value)) != NULL) return err;
+
+            value = Nan::Get(options, Nan::New("sectorKeys").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined() && (err = dictionary.ParseSectorKeys(value)) != NULL) return err;
+
+            value = Nan::Get(options, Nan::New("read").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined() && (err = plan.Parse(value)) != NULL) return err;
+
+            value = Nan::Get(options, Nan::New("presence").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) presence = Nan::To<bool>(value).FromJust();
+
+            value = Nan::Get(options, Nan::New("presenceInterval").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() == 0) return "presenceInterval option is not a positive number of milliseconds";
+                presence_interval = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("debounce").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32()) return "debounce option is not a number of milliseconds";
+                debounce = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("parseNdef").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) parse_ndef = Nan::To<bool>(value).FromJust();
+
+            value = Nan::Get(options, Nan::New("timings").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) timings = Nan::To<bool>(value).FromJust();
+
+            value = Nan::Get(options, Nan::New("paused").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) paused = Nan::To<bool>(value).FromJust();
+
+            value = Nan::Get(options, Nan::New("inventory").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) inventory = Nan::To<bool>(value).FromJust();
+
+            value = Nan::Get(options, Nan::New("journal").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsString() || value.As<String>()->Length() == 0) return "journal option is not a directory";
+                Nan::Utf8String dir(value);
+                journal = *dir;
+            }
+
+            value = Nan::Get(options, Nan::New("journalSegmentSize").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() < 64 * 1024) return "journalSegmentSize option must be at least 65536 bytes";
+                journal_segment_size = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("journalSegments").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() < 2) return "journalSegments option must be at least 2";
+                journal_segments = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("modulations").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined() && (err = ParseModulations(value)) != NULL) return err;
+
+            value = Nan::Get(options, Nan::New("pollCount").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() == 0 || Nan::To<uint32_t>(value).FromJust() > 0xff) return "pollCount option must be 1 to 255 (endless)";
+                poll_count = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("pollPeriod").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() == 0 || Nan::To<uint32_t>(value).FromJust() > 15) return "pollPeriod option must be 1 to 15 (units of 150ms)";
+                poll_period = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("polling").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                Nan::Utf8String strategy(value);
+                if (strcmp(*strategy, "device") == 0) polling = POLL_DEVICE;
+                else if (strcmp(*strategy, "fixed") == 0) polling = POLL_FIXED;
+                else if (strcmp(*strategy, "backoff") == 0) polling = POLL_BACKOFF;
+                else return "polling option must be one of device, fixed or backoff";
+            }
+
+            value = Nan::Get(options, Nan::New("pollInterval").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() == 0) return "pollInterval option is not a positive number of milliseconds";
+                poll_interval = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("pollMaxInterval").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32()) return "pollMaxInterval option is not a number of milliseconds";
+                poll_max_interval = Nan::To<uint32_t>(value).FromJust();
+            }
+            if (poll_max_interval < poll_interval) poll_max_interval = poll_interval;
+
+            value = Nan::Get(options, Nan::New("pollBurst").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32()) return "pollBurst option is not a number of milliseconds";
+                poll_burst = Nan::To<uint32_t>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("pollSpacing").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32()) return "pollSpacing option is not a number of milliseconds";
+                poll_spacing = Nan::To<uint32_t>(value).FromJust();
+            }
+            return NULL;
+        }
+
+        // [ 'iso14443a', 'felica@424', ... ], baud rates default to 106 (212 for FeliCa).
+        // Pairs libnfc rejects with NFC_EINVARG are refused here, polling them would lose the device.
+        const char *ParseModulations(Local<Value> value) {
+            static const struct {
+                const char          *name;
+                nfc_modulation_type nmt;
+                nfc_baud_rate       nbr;
+                nfc_baud_rate       min, max;
+                const char          *invalid;
+            } known[] = {
+                { "iso14443a",    NMT_ISO14443A,    NBR_106, NBR_106, NBR_106, "modulations baud rate of iso14443a must be 106" },
+                { "felica",       NMT_FELICA,       NBR_212, NBR_212, NBR_424, "modulations baud rate of felica must be 212 or 424" },
+                { "iso14443b",    NMT_ISO14443B,    NBR_106, NBR_106, NBR_847, "modulations baud rate of iso14443b must be 106 to 847" },
+                { "iso14443bi",   NMT_ISO14443BI,   NBR_106, NBR_106, NBR_847, "modulations baud rate of iso14443bi must be 106 to 847" },
+                { "iso14443b2sr", NMT_ISO14443B2SR, NBR_106, NBR_106, NBR_847, "modulations baud rate of iso14443b2sr must be 106 to 847" },
+                { "iso14443b2ct", NMT_ISO14443B2CT, NBR_106, NBR_106, NBR_847, "modulations baud rate of iso14443b2ct must be 106 to 847" },
+                { "jewel",        NMT_JEWEL,        NBR_106, NBR_106, NBR_106, "modulations baud rate of jewel must be 106" }
+            };
+
+            if (!value->IsArray() || value.As<Array>()->Length() == 0) return "modulations option is not a non-empty array";
+            Local<Array> array = value.As<Array>();
+            modulations.clear();
+            for (uint32_t i = 0; i < array->Length(); i++) {
+                Nan::Utf8String entry(Nan::Get(array, i).ToLocalChecked());
+                char name[32];
+                unsigned int baud = 0;
+                snprintf(name, sizeof name, "%s", *entry);
+                char *at = strchr(name, '@');
+                if (at) {
+                    *at++ = '\0';
+                    baud = strtoul(at, NULL, 10);
+                }
+                if (strcmp(name, "iso15693") == 0) return "iso15693 is not supported by libnfc";
+
+                size_t k;
+                for (k = 0; k < sizeof known / sizeof known[0] && strcmp(known[k].name, name) != 0; k++);
+                if (k == sizeof known / sizeof known[0]) return "modulations entries must be one of iso14443a, felica, iso14443b, iso14443bi, iso14443b2sr, iso14443b2ct or jewel";
+
+                nfc_modulation modulation = { known[k].nmt, known[k].nbr };
+                if (baud == 106) modulation.nbr = NBR_106;
+                else if (baud == 212) modulation.nbr = NBR_212;
+                else if (baud == 424) modulation.nbr = NBR_424;
+                else if (baud == 847) modulation.nbr = NBR_847;
+                else if (at) return "modulations baud rate must be 106, 212, 424 or 847";
+                if (modulation.nbr < known[k].min || modulation.nbr > known[k].max) return known[k].invalid;
+                modulations.push_back(modulation);
+            }
+            return NULL;
+        }
+
+        size_t              queue_size;
+        tag_queue_overflow  overflow;
+        bool                use_key_cache;
+        KeyDictionary       dictionary;
+        ReadPlan            plan;
+        bool                presence;
+        uint32_t            presence_interval;  // ms between presence checks
+        uint32_t            debounce;           // ms a tag may be gone before it departs
+        bool                parse_ndef;         // parse TLVs on the reader thread
+        std::vector<nfc_modulation> modulations;
+        uint8_t             poll_count;         // 0xff polls until a target shows up
+        uint8_t             poll_period;        // units of 150ms
+        bool                timings;            // per-stage timings on every read
+        bool                paused;             // start without polling until resume()
+        bool                inventory;          // read every target in the field each cycle
+        std::string         journal;            // directory reads are journaled to, empty for none
+        size_t              journal_segment_size;
+        size_t              journal_segments;
+        poll_strategy       polling;
+        uint32_t            poll_interval;      // ms between idle probes, the first one with backoff
+        uint32_t            poll_max_interval;  // ms the backoff stops growing at
+        uint32_t            poll_burst;         // ms of probing flat out after a tag left
+        uint32_t            poll_spacing;       // ms between the probes of any two readers
+    };
+
     class NFC: public Nan::ObjectWrap {
       public:
         static NAN_METHOD(New);
         static NAN_METHOD(Start);
         static NAN_METHOD(Stop);
+        static NAN_METHOD(QueueStats);
+        static NAN_METHOD(Stats);
+        static NAN_METHOD(ReadBlocks);
+        static NAN_METHOD(Write);
+        static NAN_METHOD(Increment);
+        static NAN_METHOD(Decrement);
+        static NAN_METHOD(Restore);
+        static NAN_METHOD(Transceive);
+        static NAN_METHOD(Pause);
+        static NAN_METHOD(Resume);
+        static NAN_METHOD(Detach);
+
+        NFC() : device(NULL), context(NULL), journal(NULL), reader(NULL), loop(NULL), detaching(false), run(false), claimed(false), lost(false),
+                paused(false), polling(false), abort_pending(false) {
+            uv_mutex_init(&poll_mutex);
+        }
+
+        ~NFC() {
+            uv_mutex_destroy(&poll_mutex);
+        }
+
+        void stop();
+        void detach();
+        void AbortPoll();
+        void release();
+        static void AtExit(void *arg);
+
+        Transport *device;
+        nfc_target nt;
+        nfc_context *context;
+        Journal *journal;
+        NFCOptions options;
+        NFCReader *reader;
+        uv_loop_t *loop;            // of the thread that started the reader, its events are delivered there
+        bool detaching;             // JS thread only, release() parks the device instead of closing it
+        std::atomic<bool> run;
+        std::atomic<bool> claimed;
+        std::atomic<bool> lost;     // the reader thread gave up on the device
+        std::atomic<bool> paused;   // no polling until resume()
+        uv_mutex_t poll_mutex;
+        bool polling;               // under poll_mutex, the reader thread is waiting for a target
+        bool abort_pending;         // under poll_mutex, AbortPoll() aborted the poll in flight
+        ReaderStats stats;
+    };
+
+    // Lists the attached devices every interval on its own thread and emits the difference.
+    class DeviceMonitor: public Nan::ObjectWrap {
+      public:
+        static NAN_METHOD(New);
+        static NAN_METHOD(Start);
+        static NAN_METHOD(Stop);
+        static NAN_METHOD(Devices);
+
+        DeviceMonitor() : context(NULL), async_resource("nfc:monitor"), interval(250), run(false), done(false), started(false), closing(false) {
+            uv_mutex_init(&mutex);
+            uv_cond_init(&cond);
+        }
+
+        ~DeviceMonitor() {
+            uv_cond_destroy(&cond);
+            uv_mutex_destroy(&mutex);
+        }
+
+        void stop();
+        static void AtExit(void *arg);
+
+      private:
+        static void Run(void *arg);
+        void Execute();
+        void List();
+        static NAUV_WORK_CB(HandleAsync);
+        static void HandleClose(uv_handle_t *handle);
+        void HandleEvents();
+
+        nfc_context *context;
+        Nan::AsyncResource async_resource;
+        uint32_t interval;                          // ms between listings
+        std::vector<std::string> attached;          // monitor thread only
+        uv_thread_t thread;
+        uv_async_t async;
+        uv_mutex_t mutex;
+        uv_cond_t cond;
+        bool run;                                   // under mutex
+        bool done;                                  // under mutex
+        std::deque<std::pair<bool, std::string> > events;  // under mutex, true when attached
+        std::vector<std::string> listed;            // under mutex, for devices()
+        bool started;                               // JS thread only
+        bool closing;                               // JS thread only
+    };
+
+    #define MAX_TAG_DATA (4 * 1024)
+    #define MAX_INVENTORY_TARGETS 32
+
+    static Local<Value> View(Local<Object> buffer, Local<Function> slice, size_t start, size_t length) {
+        Local<Value> argv[2] = { Nan::New<Number>(start), Nan::New<Number>(start + length) };
+        return Nan::Call(slice, buffer, 2, argv).ToLocalChecked();
+    }
+
+    // Same layout as nfc.parse() used to produce, but values are views into buffer
+    // (offsets are relative to base) rather than hex strings.
+    static Local<Array> NdefToNode(const NdefParser &parser, Local<Object> buffer, size_t base) {
+        Local<Function> slice = Nan::Get(buffer, Nan::New("slice").ToLocalChecked()).ToLocalChecked().As<Function>();
+        Local<Array> tlvs = Nan::New<Array>();
+
+        for (size_t i = 0; i < parser.tlvs.size(); i++) {
+            const NdefTlv &tlv = parser.tlvs[i];
+            Local<Object> object = Nan::New<Object>();
+            Nan::Set(object, Nan::New("type").ToLocalChecked(), Nan::New<Int32>(tlv.type));
+            if (tlv.has_length) Nan::Set(object, Nan::New("len").ToLocalChecked(), Nan::New<Number>(tlv.length));
+            if (tlv.has_value) Nan::Set(object, Nan::New("value").ToLocalChecked(), View(buffer, slice, base + tlv.value_offset, tlv.length));
+            if (tlv.has_ndef) {
+                Local<Array> records = Nan::New<Array>();
+                for (size_t r = 0; r < tlv.num_records; r++) {
+                    const NdefRecord &record = parser.records[tlv.first_record + r];
+                    Local<Object> entry = Nan::New<Object>();
+                    Nan::Set(entry, Nan::New("tnf").ToLocalChecked(), Nan::New<Int32>(record.tnf));
+                    Nan::Set(entry, Nan::New("mb").ToLocalChecked(), Nan::New(record.mb));
+                    Nan::Set(entry, Nan::New("me").ToLocalChecked(), Nan::New(record.me));
+                    Nan::Set(entry, Nan::New("cf").ToLocalChecked(), Nan::New(record.cf));
+                    Nan::Set(entry, Nan::New("type").ToLocalChecked(), View(buffer, slice, base + record.type_offset, record.type_length));
+                    if (record.has_id) Nan::Set(entry, Nan::New("id").ToLocalChecked(), View(buffer, slice, base + record.id_offset, record.id_length));
+                    Nan::Set(entry, Nan::New("payload").ToLocalChecked(), View(buffer, slice, base + record.payload_offset, record.payload_length));
+                    Nan::Set(records, r, entry);
+                }
+                Nan::Set(object, Nan::New("ndef").ToLocalChecked(), records);
+            }
+            Nan::Set(tlvs, i, object);
+        }
+        return tlvs;
+    }
+
+    // Recycled through its reader's RecordPool. deviceID and name point at strings the
+    // reader interned at start, tag and event are literals, and the data is read straight
+    // into a pool slab that node adopts as the Buffer, so a read allocates nothing.
+    class NFCCard {
+      public:
+        NFCCard() : records(NULL), slabs(NULL), slab(NULL), next(NULL) {
+            Reset();
+        }
+
+        ~NFCCard() {
+            Reset();
+        }
+
+        void Attach(RecordPool<NFCCard> *records, SlabPool *slabs) {
+            this->records = records;
+            this->slabs = slabs;
+        }
+
+        void Reset() {
+            if(slab) slabs->Release(slab);
+            slab = NULL;
+            deviceID = name = tag = NULL;
+            uid[0] = error[0] = '\0';
+            uid_len = 0;
+            atqa[0] = atqa[1] = sak = 0;
+            journal_position = -1;
+            type = 0;
+            data_size = offset = 0;
+            has_data = false;
+            parsed = false;
+            auth_attempts = auth_saved = auth_cached = -1;
+            probe_us = read_us = -1;
+            found_at = queued_at = 0;
+            frames = 0;
+            detailed = false;
+            event = "read";
+        }
+
+        // Returns the card and the ones appended to it to their pool, also used as the TagQueue disposer.
+        static void Dispose(NFCCard *card) {
+            while(card) {
+                NFCCard *next = card->next;
+                card->next = NULL;
+                card->Reset();
+                if(card->records) card->records->Release(card);
+                else delete card;
+                card = next;
+            }
+        }
+
+        // Batches travel through the queue as one record, e.g. an inventory and its reads.
+        void Append(NFCCard *card) {
+            NFCCard *last = this;
+            while(last->next) last = last->next;
+            last->next = card;
+        }
+        NFCCard *Next() const {
+            return next;
+        }
+
+        void AddToNodeObject(Local<Object> object) {
+            if(deviceID) Nan::Set(object, Nan::New("deviceID").ToLocalChecked(), Nan::New(deviceID).ToLocalChecked());
+            if(name) Nan::Set(object, Nan::New("name").ToLocalChecked(), Nan::New(name).ToLocalChecked());
+            if(uid[0]) Nan::Set(object, Nan::New("uid").ToLocalChecked(), Nan::New(uid).ToLocalChecked());
+            if(journal_position >= 0) Nan::Set(object, Nan::New("journal").ToLocalChecked(), Nan::New<Number>(journal_position));
+            if(type) Nan::Set(object, Nan::New("type").ToLocalChecked(), Nan::New<Int32>(type));
+            if(tag) Nan::Set(object, Nan::New("tag").ToLocalChecked(), Nan::New(tag).ToLocalChecked());
+            if(error[0]) Nan::Set(object, Nan::New("error").ToLocalChecked(), Nan::Error(error));
+            if(has_data) {
+                Local<Object> buffer;
+                if(data_size > 0) {
+                    slabs->Ref(); //held by the Buffer until node frees it
+                    buffer = Nan::NewBuffer((char*)slab, data_size, SlabPool::FreeCallback, slabs).ToLocalChecked();
+                    slab = NULL; //ownership transferred to nodejs
+                } else {
+                    buffer = Nan::NewBuffer(0).ToLocalChecked();
+                }
+                Nan::Set(object, Nan::New("data").ToLocalChecked(), buffer);
+                Nan::Set(object, Nan::New("offset").ToLocalChecked(), Nan::New<Int32>((int32_t)offset));
+                if(parsed) Nan::Set(object, Nan::New("ndef").ToLocalChecked(), NdefToNode(ndef, buffer, offset));
+            }
+            if(auth_attempts >= 0) {
+                Local<Object> auth = Nan::New<Object>();
+                Nan::Set(auth, Nan::New("attempts").ToLocalChecked(), Nan::New<Int32>(auth_attempts));
+                Nan::Set(auth, Nan::New("saved").ToLocalChecked(), Nan::New<Int32>(auth_saved));
+                Nan::Set(auth, Nan::New("cached").ToLocalChecked(), Nan::New<Int32>(auth_cached));
+                Nan::Set(object, Nan::New("auth").ToLocalChecked(), auth);
+            }
+            if(read_us >= 0 || detailed) {
+                Local<Object> timings = Nan::New<Object>();
+                if(read_us >= 0) {
+                    Nan::Set(timings, Nan::New("read").ToLocalChecked(), Nan::New<Number>(read_us));
+                    if(probe_us >= 0) Nan::Set(timings, Nan::New("probe").ToLocalChecked(), Nan::New<Number>(probe_us));
+                    else Nan::Set(timings, Nan::New("probeSkipped").ToLocalChecked(), Nan::New(true));
+                } else {
+                    Nan::Set(timings, Nan::New("read").ToLocalChecked(), Nan::New<Number>((queued_at - found_at) / 1000));
+                }
+                if(detailed) {
+                    Nan::Set(timings, Nan::New("queue").ToLocalChecked(), Nan::New<Number>((uv_hrtime() - queued_at) / 1000));
+                    Nan::Set(timings, Nan::New("frames").ToLocalChecked(), Nan::New<Int32>(frames));
+                }
+                Nan::Set(object, Nan::New("timings").ToLocalChecked(), timings);
+            }
+        }
+
+        // deviceID and name must outlive the card, the reader keeps them for its lifetime.
+        void SetDevice(const char *deviceID, const char *name) {
+            this->deviceID = deviceID;
+            this->name = name;
+        }
+        void SetUID(const char *uid) {
+            snprintf(this->uid, sizeof this->uid, "%s", uid);
+        }
+        // The identifier as bytes, and the ISO14443A answers, for the journal.
+        void SetTarget(const uint8_t *id, size_t id_len, const uint8_t *atqa, uint8_t sak) {
+            uid_len = id_len < sizeof uid_bytes ? id_len : sizeof uid_bytes;
+            memcpy(uid_bytes, id, uid_len);
+            if(atqa) memcpy(this->atqa, atqa, 2);
+            this->sak = sak;
+        }
+        // Reader thread, before the card is queued for node. false when it could not be written.
+        bool WriteTo(Journal *journal) {
+            JournalRecord record;
+            record.device_id = deviceID;
+            record.uid = uid_bytes;
+            record.uid_len = uid_len;
+            memcpy(record.atqa, atqa, 2);
+            record.sak = sak;
+            record.type = type;
+            record.tag = tag;
+            record.error = error[0] ? error : NULL;
+            record.read_us = read_us >= 0 ? read_us : (int64_t) (queued_at - found_at) / 1000;
+            record.probe_us = probe_us;
+            record.frames = frames;
+            record.auth_attempts = auth_attempts;
+            record.data = has_data && data_size > 0 ? slab : NULL;
+            record.data_size = has_data ? data_size : 0;
+            record.offset = offset;
+            journal_position = journal->Append(record);
+            return journal_position >= 0;
+        }
+        void SetType(int32_t type) {
+            this->type = type;
+        }
+        // tags carry a literal, never freed.
+        void SetTag(const char *tag) {
+            this->tag = tag;
+        }
+        void SetError(const char *error) {
+            snprintf(this->error, sizeof this->error, "%s", error);
+        }
+        void SetOffset(size_t offset) {
+            this->offset = offset;
+        }
+        void SetAuthStats(int32_t attempts, int32_t saved, int32_t cached) {
+            auth_attempts = attempts;
+            auth_saved = saved;
+            auth_cached = cached;
+        }
+        // events carry a literal, never freed.
+        void SetEvent(const char *event) {
+            this->event = event;
+        }
+        const char *Event() const {
+            return event;
+        }
+        void SetProbeTime(int64_t us) {
+            probe_us = us;
+        }
+        void SetReadTime(int64_t us) {
+            read_us = us;
+        }
+        int64_t ProbeTime() const {
+            return probe_us;
+        }
+        int32_t AuthAttempts() const {
+            return auth_attempts;
+        }
+        bool Failed() const {
+            return error[0] != '\0';
+        }
+        // uv_hrtime() when the tag was found and when its read was queued, 0 for events.
+        void SetTrace(uint64_t found_at, uint64_t queued_at, int32_t frames, bool detailed) {
+            this->found_at = found_at;
+            this->queued_at = queued_at;
+            this->frames = frames;
+            this->detailed = detailed;
+        }
+        uint64_t FoundAt() const {
+            return found_at;
+        }
+        uint64_t QueuedAt() const {
+            return queued_at;
+        }
+        // MAX_TAG_DATA bytes to read the tag into, taken from the pool on first use.
+        uint8_t *Data() {
+            if(!slab) slab = slabs->Acquire();
+            return slab;
+        }
+        void SetDataSize(size_t data_size) {
+            this->data_size = data_size;
+            has_data = true;
+        }
+        // Reader thread, parses the data from offset on. The parser's storage is kept
+        // with the pooled card, so this stops allocating once warmed up.
+        void ParseNdef() {
+            ndef.Parse(slab + offset, offset < data_size ? data_size - offset : 0);
+            parsed = true;
+        }
+      private:
+        RecordPool<NFCCard> *records;
+        SlabPool    *slabs;
+        uint8_t     *slab;
+        const char  *deviceID;
+        const char  *name;
+        char        uid[3 * 10];
+        uint8_t     uid_bytes[10];
+        size_t      uid_len;
+        uint8_t     atqa[2];
+        uint8_t     sak;
+        int64_t     journal_position;
+        int32_t     type;
+        const char  *tag;
+        char        error[256];
+        size_t      offset;
+        size_t      data_size;
+        bool        has_data;
+        NdefParser  ndef;
+        bool        parsed;
+        int32_t     auth_attempts;
+        int32_t     auth_saved;
+        int32_t     auth_cached;
+        int64_t     probe_us;
+        int64_t     read_us;
+        uint64_t    found_at;
+        uint64_t    queued_at;
+        int32_t     frames;
+        bool        detailed;
+        const char  *event;
+        NFCCard     *next;
+    };
+
+    // Work queued from JS that runs on the reader thread against the selected tag.
+    class NFCCommand {
+      public:
+        explicit NFCCommand(Local<Function> callback) : callback(callback), async_resource("nfc:command"), error(NULL) {}
+
+        virtual ~NFCCommand() {
+            free(error);
+        }
+
+        // reader thread, with a tag selected and easy framing on.
+        virtual void Execute(NFCReader *reader) = 0;
+        // JS thread, only called when no error was set.
+        virtual Local<Value> Result() = 0;
+
+        void SetError(const char *error) {
+            free(this->error);
+            this->error = strdup(error);
+        }
+
+        void Complete() {
+            Nan::HandleScope scope;
+
+            Local<Value> argv[2];
+            if (error) {
+                argv[0] = Nan::Error(error);
+                argv[1] = Nan::Undefined();
+            } else {
+                argv[0] = Nan::Null();
+                argv[1] = Result();
+            }
+            callback.Call(2, argv, &async_resource);
+        }
+
+      private:
+        Nan::Callback callback;
+        Nan::AsyncResource async_resource;
+        char *error;
+    };
+
+    // stats() reports failed frames by libnfc error, named as nfc_strerror names them.
+    static const struct {
+        int         code;
+        const char  *name;
+    } error_classes[] = {
+        { 0,                "Unknown error" },
+        { NFC_EIO,          "Input / Output Error" },
+        { NFC_EINVARG,      "Invalid argument(s)" },
+        { NFC_EDEVNOTSUPP,  "Not Supported by Device" },
+        { NFC_ENOTSUCHDEV,  "No Such Device" },
+        { NFC_EOVFLOW,      "Buffer Overflow" },
+        { NFC_ETIMEOUT,     "Timeout" },
+        { NFC_EOPABORTED,   "Operation Aborted" },
+        { NFC_ENOTIMPL,     "Not (yet) Implemented" },
+        { NFC_ETGRELEASED,  "Target Released" },
+        { NFC_EMFCAUTHFAIL, "Mifare Authentication Failed" },
+        { NFC_ERFTRANS,     "RF Transmission Error" },
+        { NFC_ECHIP,        "Device's Internal Chip Error" },
+    };
+    static const size_t num_error_classes = sizeof error_classes / sizeof error_classes[0];
+
+    static size_t ErrorClass(int code) {
+        for (size_t i = 1; i < num_error_classes; i++) {
+            if (error_classes[i].code == code) return i;
+        }
+        return 0;
+    }
+
+    // Records a reader's pools hold for a full queue. An inventory entry chains a record for
+    // every target listed plus the departed ones, so it is sized for MAX_INVENTORY_TARGETS + 1.
+    static size_t PooledRecords(const NFCOptions &options) {
+        size_t entries = TagQueue<NFCCard>::CapacityFor(options.queue_size);
+        return options.inventory ? entries * (MAX_INVENTORY_TARGETS + 1) : entries;
+    }
+
+    class NFCReader {
+      public:
+        NFCReader(NFC *baton, Local<Object>self)
+            : baton(baton), self(self), async_resource("nfc:reader"), ultralight_pages(0), fast_read(false),
+              records(PooledRecords(baton->options) + 4),
+              slabs(new SlabPool(MAX_TAG_DATA, PooledRecords(baton->options) + 16)),
+              queue(baton->options.queue_size, baton->options.overflow, NFCCard::Dispose),
+              slot(baton->run, baton->paused, (uint64_t) baton->options.poll_spacing * 1000 * 1000),
+              next_probe(0), backoff(baton->options.poll_interval), burst_until(0), device_polls(true), done(false) {
+                baton->run = true;
+                baton->lost = false;
+                failure[0] = '\0';
+                frames = 0;
+                journaled = 0;
+                journal_failures = 0;
+                snprintf(device_id, sizeof device_id, "%s", baton->device->Connstring());
+                snprintf(device_name, sizeof device_name, "%s", baton->device->Name());
+                uv_mutex_init(&mutex);
+                uv_mutex_init(&command_mutex);
+                uv_cond_init(&cond);
+                uv_async_init(baton->loop, &async, HandleAsync);
+                async.data = this;
+        }
+
+        ~NFCReader() {
+            NFCCard *tag;
+            while((tag = queue.Pop()) != NULL) NFCCard::Dispose(tag);
+            slabs->Unref(); //outlives the reader while node holds Buffers from it
+
+            uv_cond_destroy(&cond);
+            uv_mutex_destroy(&command_mutex);
+            uv_mutex_destroy(&mutex);
+            self.Reset();
+        }
+
+        // Each reader gets its own native thread, the libuv threadpool is left alone.
+        int Start() {
+            return uv_thread_create(&thread, Run, this);
+        }
+
+        void Join() {
+            uv_thread_join(&thread);
+        }
+
+        // Sleeps until the reader thread has left Execute, false on timeout.
+        bool WaitDone(uint64_t timeout) {
+            uv_mutex_lock(&mutex);
+            while(!done.load(std::memory_order_acquire)) {
+                if(uv_cond_timedwait(&cond, &mutex, timeout) != 0) break;
+            }
+            uv_mutex_unlock(&mutex);
+            return done.load(std::memory_order_acquire);
+        }
+
+        void Close() {
+            uv_close((uv_handle_t*)&async, HandleClose);
+        }
+
+        static void Run(void *arg) {
+            NFCReader *reader = static_cast<NFCReader*>(arg);
+            reader->Execute();
+
+            uv_mutex_lock(&reader->mutex);
+            reader->done.store(true, std::memory_order_release);
+            uv_cond_broadcast(&reader->cond);
+            uv_mutex_unlock(&reader->mutex);
+            uv_async_send(&reader->async);
+        }
+
+        static NAUV_WORK_CB(HandleAsync) {
+            static_cast<NFCReader*>(async->data)->HandleProgressCallback();
+        }
+
+        static void HandleClose(uv_handle_t *handle) {
+            delete static_cast<NFCReader*>(handle->data);
+        }
+
+        // A device that was lost (e.g. unplugged) stops the reader with the reason as argument,
+        // a detached one is announced first with the deviceID start() takes it over with.
+        void HandleOKCallback(bool detached) {
+            Local<Value> argv[2];
+            if(detached) {
+                argv[0] = Nan::New("detached").ToLocalChecked();
+                argv[1] = Nan::New(device_id).ToLocalChecked();
+                async_resource.runInAsyncScope(Nan::New(self), "emit", 2, argv);
+            }
+
+            argv[0] = Nan::New("stopped").ToLocalChecked();
+            if(failure[0]) argv[1] = Nan::Error(failure);
+
+            async_resource.runInAsyncScope(Nan::New(self), "emit", failure[0] ? 2 : 1, argv);
+        }
+
+        NFCCard *NewCard() {
+            NFCCard *tag = records.Acquire();
+            tag->Attach(&records, slabs);
+            return tag;
+        }
+
+        // Heap allocations made because a pool ran dry, none in steady state.
+        size_t Allocations() const {
+            return records.Misses() + slabs->Misses();
+        }
+
+        // The stages of a read, the JS thread adds queue wait and callback time.
+        void Trace(NFCCard *tag, uint64_t found) {
+            ReaderStats &stats = baton->stats;
+            uint64_t now = uv_hrtime();
+
+            tag->SetTrace(found, now, frames, baton->options.timings);
+            stats.reads++;
+            if(tag->Failed()) stats.failed_reads++;
+            stats.read.Record((now - found) / 1000);
+            stats.frames.Record(frames);
+            if(tag->ProbeTime() >= 0) stats.probe.Record(tag->ProbeTime());
+            if(tag->AuthAttempts() >= 0) stats.auth_attempts.Record(tag->AuthAttempts());
+        }
+
+        // Never waits on the JS thread unless the overflow policy is "block", or the queue is full
+        // and the record is one that can't be dropped.
+        void Send(NFCCard *tag) {
+            if(baton->journal) JournalReads(tag);
+            queue.Push(tag, strcmp(tag->Event(), "read") != 0); //presence events and inventories are never dropped
+            uv_async_send(&async);
+        }
+
+        // Reads, also those in an inventory, are on disk before node hears of them.
+        void JournalReads(NFCCard *tag) {
+            for(; tag; tag = tag->Next()) {
+                if(strcmp(tag->Event(), "read") != 0) continue;
+                if(tag->WriteTo(baton->journal)) journaled++;
+                else journal_failures++;
+            }
+        }
+
+        // JS thread, commands run the next time the reader has a tag selected.
+        void Queue(NFCCommand *command) {
+            uv_mutex_lock(&command_mutex);
+            commands.push_back(command);
+            uv_mutex_unlock(&command_mutex);
+            Wake();
+        }
+
+        void ServiceCommands() {
+            std::deque<NFCCommand*> batch;
+            uv_mutex_lock(&command_mutex);
+            batch.swap(commands);
+            uv_mutex_unlock(&command_mutex);
+            if(batch.empty()) return;
+
+            while(!batch.empty()) {
+                NFCCommand *command = batch.front();
+                batch.pop_front();
+
+                if(!baton->run) command->SetError("NFC device stopped");
+                else if(baton->device->SetPropertyBool(NP_EASY_FRAMING, true) < 0) command->SetError(baton->device->StrError());
+                else command->Execute(this);
+
+                uv_mutex_lock(&command_mutex);
+                completed.push_back(command);
+                uv_mutex_unlock(&command_mutex);
+            }
+            uv_async_send(&async);
+        }
+
+        // The field stays off while paused, the device keeps its initiator setup so resume() polls
+        // again right away. Stop and resume() end the wait.
+        void WaitWhilePaused() {
+            baton->device->SetPropertyBool(NP_ACTIVATE_FIELD, false);
+            uv_mutex_lock(&mutex);
+            while(baton->run && baton->paused) uv_cond_wait(&cond, &mutex);
+            uv_mutex_unlock(&mutex);
+            baton->device->SetPropertyBool(NP_ACTIVATE_FIELD, true);
+        }
+
+        // Stop and newly queued commands cut the sleep short.
+        void Sleep(uint64_t ms) {
+            uv_mutex_lock(&mutex);
+            uv_mutex_lock(&command_mutex);
+            bool pending = !commands.empty();   //queued before we got here, its Wake() is gone
+            uv_mutex_unlock(&command_mutex);
+            if(baton->run && !pending) uv_cond_timedwait(&cond, &mutex, ms * 1000 * 1000);
+            uv_mutex_unlock(&mutex);
+        }
+
+        void Wake() {
+            uv_mutex_lock(&mutex);
+            uv_cond_broadcast(&cond);
+            uv_mutex_unlock(&mutex);
+            poll_scheduler->Interrupt(slot);
+        }
+
+        void SendEvent(const char *event, const nfc_target &nt) {
+            NFCCard *tag = NewCard();
+            tag->SetEvent(event);
+            Describe(tag, nt);
+            Send(tag);
+        }
+
+        // The identifier each modulation reports for the target (UID, IDm, PUPI, ...).
+        static size_t TargetId(const nfc_target &nt, const uint8_t **id) {
+            switch (nt.nm.nmt) {
+                case NMT_ISO14443A:
+                    *id = nt.nti.nai.abtUid;
+                    return nt.nti.nai.szUidLen < sizeof nt.nti.nai.abtUid ? nt.nti.nai.szUidLen : sizeof nt.nti.nai.abtUid;
+                case NMT_FELICA:        *id = nt.nti.nfi.abtId;    return sizeof nt.nti.nfi.abtId;
+                case NMT_ISO14443B:     *id = nt.nti.nbi.abtPupi;  return sizeof nt.nti.nbi.abtPupi;
+                case NMT_ISO14443BI:    *id = nt.nti.nii.abtDIV;   return sizeof nt.nti.nii.abtDIV;
+                case NMT_ISO14443B2SR:  *id = nt.nti.nsi.abtUID;   return sizeof nt.nti.nsi.abtUID;
+                case NMT_ISO14443B2CT:  *id = nt.nti.nci.abtUID;   return sizeof nt.nti.nci.abtUID;
+                case NMT_JEWEL:         *id = nt.nti.nji.btId;     return sizeof nt.nti.nji.btId;
+                case NMT_DEP:           *id = nt.nti.ndi.abtNFCID3; return sizeof nt.nti.ndi.abtNFCID3;
+                default:                *id = NULL;                return 0;
+            }
+        }
+
+        static const char *ModulationName(nfc_modulation_type nmt) {
+            switch (nmt) {
+                case NMT_ISO14443A:     return "iso14443a";
+                case NMT_FELICA:        return "felica";
+                case NMT_ISO14443B:     return "iso14443b";
+                case NMT_ISO14443BI:    return "iso14443bi";
+                case NMT_ISO14443B2SR:  return "iso14443b2sr";
+                case NMT_ISO14443B2CT:  return "iso14443b2ct";
+                case NMT_JEWEL:         return "jewel";
+                case NMT_DEP:           return "dep";
+                default:                return "unknown";
+            }
+        }
+
+        static bool SameTarget(const nfc_target &a, const nfc_target &b) {
+            const uint8_t *a_id, *b_id;
+            size_t a_len = TargetId(a, &a_id), b_len = TargetId(b, &b_id);
+            return a.nm.nmt == b.nm.nmt && a_len == b_len && memcmp(a_id, b_id, a_len) == 0;
+        }
+
+        // Not every driver can check presence for every modulation, those fall back to selecting again.
+        bool StillPresent(const nfc_target &present) {
+            int res = baton->device->TargetIsPresent(&present);
+            if (res != NFC_EDEVNOTSUPP) return res == NFC_SUCCESS;
+
+            nfc_target nt;
+            baton->device->SetPropertyBool(NP_INFINITE_SELECT, false);
+            res = baton->device->SelectPassiveTarget(present.nm, NULL, 0, &nt);
+            baton->device->SetPropertyBool(NP_INFINITE_SELECT, true);
+            return res > 0 && SameTarget(nt, present);
+        }
+
+        // Keeps the selected tag until it leaves the field, only checking that it is still
+        // there instead of reading it again. A tag that comes back within the debounce
+        // window counts as never having left. Returns true when another tag was selected
+        // while waiting out the window, it is left in baton->nt.
+        bool TrackPresence() {
+            const NFCOptions &options = baton->options;
+            nfc_target present = baton->nt;
+
+            for (;;) {
+                while(baton->run && StillPresent(present)) {
+                    ServiceCommands();
+                    Sleep(options.presence_interval);
+                }
+                if(!baton->run) return false;
+
+                bool back = false, other = false;
+                uint64_t deadline = uv_hrtime() + options.debounce * 1000 * 1000;
+                baton->device->SetPropertyBool(NP_INFINITE_SELECT, false);
+                while(baton->run && uv_hrtime() < deadline) {
+                    if(baton->device->SelectPassiveTarget(present.nm, NULL, 0, &baton->nt) > 0) {
+                        back = SameTarget(baton->nt, present);
+                        other = !back;
+                        break;
+                    }
+                    Sleep(options.presence_interval);
+                }
+                baton->device->SetPropertyBool(NP_INFINITE_SELECT, true);
+                if(back) continue;
+
+                if(baton->run) SendEvent("departed", present);
+                return other;
+            }
+        }
+
+        // With the device strategy the device polls the configured modulations itself, pollCount
+        // rounds of pollPeriod each, so the host only hears back when a target shows up or the
+        // rounds run out. Drivers that can't poll fall back to Select(). The other strategies probe
+        // each modulation once per slot the scheduler grants, see Idle(). pause() aborts a poll in
+        // flight, the loop then waits for resume().
+        bool Poll() {
+            const NFCOptions &options = baton->options;
+            bool scheduled = options.polling != POLL_DEVICE;
+            if(scheduled) baton->device->SetPropertyBool(NP_INFINITE_SELECT, false);
+            while(baton->run) {
+                if(baton->paused) {
+                    WaitWhilePaused();
+                    continue;
+                }
+                if(scheduled && !poll_scheduler->Wait(slot, next_probe)) continue; //stopped or paused meanwhile
+                if(!BeginPoll()) continue;
+
+                baton->stats.polls++;
+                int res;
+                if(scheduled) res = Probe();
+                else if(!device_polls) res = Select();
+                else res = baton->device->PollTarget(&options.modulations[0], options.modulations.size(),
+                                                     options.poll_count, options.poll_period, &baton->nt);
+                if(!EndPoll(res)) continue;
+                if(res > 0) return true;
+                if(res == NFC_EOPABORTED && baton->run) continue; //pause(), or an abort meant for a previous reader
+                if(res == NFC_EDEVNOTSUPP && device_polls && !scheduled) {
+                    device_polls = false;   //no InAutoPoll, e.g. not a PN53x
+                    continue;
+                }
+                if(res < 0 && res != NFC_ETIMEOUT) {
+                    if(baton->run) {
+                        baton->stats.Failure(ErrorClass(res));
+                        snprintf(failure, sizeof failure, "%s: %s", scheduled || !device_polls ? "nfc_initiator_select_passive_target" : "nfc_initiator_poll_target",
+                                 baton->device->StrError());
+                        baton->lost = true;
+                    }
+                    return false;
+                }
+                if(scheduled) Idle();
+                else if(!device_polls) Sleep(options.poll_interval);   //several modulations, probed in turn
+            }
+            return false;
+        }
+
+        // Polling without the device's help: with one modulation the select itself waits for a target,
+        // as before polling was added, several are probed in turn every pollInterval.
+        int Select() {
+            const NFCOptions &options = baton->options;
+            if(options.modulations.size() == 1) {
+                baton->device->SetPropertyBool(NP_INFINITE_SELECT, true);
+                return baton->device->SelectPassiveTarget(options.modulations[0], NULL, 0, &baton->nt);
+            }
+            baton->device->SetPropertyBool(NP_INFINITE_SELECT, false);
+            return Probe();
+        }
+
+        // The poll only starts while pause() and detach() can still see it, so their abort can't miss it.
+        bool BeginPoll() {
+            uv_mutex_lock(&baton->poll_mutex);
+            bool start = baton->run && !baton->paused;
+            baton->polling = start;
+            uv_mutex_unlock(&baton->poll_mutex);
+            return start;
+        }
+
+        // An abort that landed after the poll had already returned would fail the next command on the
+        // device, so it is spent on a select whose result is thrown away, as is the poll's. False then.
+        bool EndPoll(int res) {
+            uv_mutex_lock(&baton->poll_mutex);
+            bool stale = baton->abort_pending && res != NFC_EOPABORTED;
+            baton->polling = false;
+            baton->abort_pending = false;
+            uv_mutex_unlock(&baton->poll_mutex);
+            if(!stale) return true;
+
+            nfc_target nt;
+            baton->device->SetPropertyBool(NP_INFINITE_SELECT, false);
+            baton->device->SelectPassiveTarget(baton->options.modulations[0], NULL, 0, &nt);
+            return false;
+        }
+
+        // One select per modulation without infinite select, returns as soon as one finds a target.
+        int Probe() {
+            const NFCOptions &options = baton->options;
+            for(size_t m = 0; m < options.modulations.size() && baton->run; m++) {
+                int res = baton->device->SelectPassiveTarget(options.modulations[m], NULL, 0, &baton->nt);
+                if(res != 0) return res;
+            }
+            return 0;
+        }
+
+        // After an empty probe or inventory cycle: the next probe is pollInterval away, with backoff
+        // the interval doubles up to pollMaxInterval while nothing shows up. Within pollBurst of a
+        // tag leaving the reader probes again as soon as the scheduler's spacing allows.
+        void Idle() {
+            const NFCOptions &options = baton->options;
+            uint64_t now = uv_hrtime();
+            if(now < burst_until) {
+                next_probe = now;
+                return;
+            }
+            next_probe = now + (uint64_t) backoff * 1000 * 1000;
+            if(options.polling == POLL_BACKOFF) backoff = std::min(backoff * 2, options.poll_max_interval);
+        }
+
+        // A tag left (or was read with presence off), the next one is likely close behind.
+        void Departed() {
+            uint64_t now = uv_hrtime();
+            burst_until = now + (uint64_t) baton->options.poll_burst * 1000 * 1000;
+            backoff = baton->options.poll_interval;
+            next_probe = now;
+        }
+
+        void Execute() {
+            if(baton->options.inventory) return Inventory();
+
+            bool selected = false;
+            while(baton->run && (selected || Poll())) {
+                uint64_t found = uv_hrtime();
+                baton->claimed = true;
+                ultralight_pages = 0;
+                frames = 0;
+                if(baton->options.presence) SendEvent("arrived", baton->nt);
+
+                NFCCard *tag = NewCard();
+                if(baton->run) ReadTag(tag);
+
+                if(baton->run) {
+                    Trace(tag, found);
+                    Send(tag);
+                } else {
+                    NFCCard::Dispose(tag); //aborted halfway, don't report a partial read.
+                }
+
+                ServiceCommands();
+                selected = baton->options.presence && TrackPresence();
+                baton->claimed = false;
+                if(!selected) Departed();
+            }
+        }
+
+        struct InventoryEntry {
+            nfc_target  nt;
+            uint64_t    seen;       // uv_hrtime() of the last cycle that listed it
+        };
+
+        // Inventory mode lists every target in the field once per cycle, then selects, reads and
+        // deselects the ones the previous cycles hadn't seen. The cycle's reads, and the targets
+        // missing for longer than the debounce window, go to JS as one record.
+        void Inventory() {
+            const NFCOptions &options = baton->options;
+            nfc_target targets[MAX_INVENTORY_TARGETS];
+            std::vector<InventoryEntry> known;
+
+            bool scheduled = options.polling != POLL_DEVICE;
+            baton->device->SetPropertyBool(NP_INFINITE_SELECT, false);  //listed targets that left don't block
+            while(baton->run) {
+                if(baton->paused) {
+                    WaitWhilePaused();
+                    continue;
+                }
+                if(scheduled && !poll_scheduler->Wait(slot, next_probe)) continue;
+                baton->stats.polls++;
+
+                // listing and deselecting leave cards halted, cycling the field wakes them for this listing.
+                baton->device->SetPropertyBool(NP_ACTIVATE_FIELD, false);
+                baton->device->SetPropertyBool(NP_ACTIVATE_FIELD, true);
+
+                uint64_t cycle = uv_hrtime();
+                NFCCard *batch = NewCard();
+                batch->SetEvent("inventory");
+                batch->SetDevice(device_id, device_name);
+
+                for(size_t m = 0; m < options.modulations.size() && baton->run; m++) {
+                    int res = baton->device->ListPassiveTargets(options.modulations[m], targets, MAX_INVENTORY_TARGETS);
+                    if(res < 0) {
+                        if(baton->run) {
+                            baton->stats.Failure(ErrorClass(res));
+                            snprintf(failure, sizeof failure, "nfc_initiator_list_passive_targets: %s", baton->device->StrError());
+                            baton->lost = true;
+                        }
+                        NFCCard::Dispose(batch);
+                        return;
+                    }
+
+                    for(int i = 0; i < res && baton->run; i++) {
+                        size_t k;
+                        for(k = 0; k < known.size() && !SameTarget(known[k].nt, targets[i]); k++);
+                        if(k < known.size()) {
+                            known[k].seen = cycle;   //still there, or listed twice
+                            continue;
+                        }
+
+                        InventoryEntry entry = { targets[i], cycle };
+                        known.push_back(entry);
+                        batch->Append(ReadListed(targets[i]));
+                    }
+                }
+                if(!baton->run) {
+                    NFCCard::Dispose(batch); //aborted halfway, don't report a partial inventory.
+                    break;
+                }
+
+                bool departed = false;
+                for(size_t k = 0; k < known.size();) {
+                    if(known[k].seen == cycle || cycle - known[k].seen < (uint64_t) options.debounce * 1000 * 1000) {
+                        k++;
+                        continue;
+                    }
+                    departed = true;
+                    if(options.presence) {
+                        NFCCard *tag = NewCard();
+                        tag->SetEvent("departed");
+                        Describe(tag, known[k].nt);
+                        batch->Append(tag);
+                    }
+                    known.erase(known.begin() + k);
+                }
+
+                if(batch->Next()) {
+                    batch->SetTrace(cycle, uv_hrtime(), 0, false);
+                    Send(batch);
+                } else {
+                    NFCCard::Dispose(batch);
+                }
+
+                // Scheduled, an empty field backs off and the known targets are checked every presenceInterval.
+                if(!scheduled) {
+                    Sleep(options.presence_interval);
+                    continue;
+                }
+                if(departed) Departed();
+                if(known.empty()) Idle();
+                else next_probe = uv_hrtime() + (uint64_t) options.presence_interval * 1000 * 1000;
+            }
+        }
+
+        // Listing leaves ISO14443A targets halted, so they are woken up by UID for the read.
+        NFCCard *ReadListed(const nfc_target &listed) {
+            uint64_t found = uv_hrtime();
+            NFCCard *tag = NewCard();
+            bool iso14443a = listed.nm.nmt == NMT_ISO14443A;
+
+            baton->claimed = true;
+            baton->nt = listed;
+            ultralight_pages = 0;
+            frames = 0;
+            if(iso14443a && Reselect() <= 0) {
+                char result[BUFSIZ];
+                snprintf(result, sizeof result, "nfc_initiator_select_passive_target: %s", baton->device->StrError());
+                Describe(tag, listed);
+                tag->SetError(result);
+            } else {
+                ReadTag(tag);
+                ServiceCommands();
+            }
+            if(iso14443a) baton->device->DeselectTarget();
+            baton->claimed = false;
+
+            Trace(tag, found);
+            return tag;
+        }
+
+        #define MAX_DEVICE_COUNT 16
+        #define MAX_FRAME_LENGTH 264
+        #define MAX_FAST_READ_PAGES ((MAX_FRAME_LENGTH - 24) / 4)
+
+        #define UL_GET_VERSION 0x60
+        #define UL_FAST_READ 0x3a
+        #define UL_WRITE 0xa2
+
+        // Wakes the current tag up again by its UID, e.g. after a command it rejected halted it.
+        int Reselect() {
+            uint8_t uid[sizeof baton->nt.nti.nai.abtUid];
+            size_t uid_len = baton->nt.nti.nai.szUidLen;
+
+            memcpy(uid, baton->nt.nti.nai.abtUid, sizeof uid);
+            return baton->device->SelectPassiveTarget(baton->nt.nm, uid, uid_len, &baton->nt);
+        }
+
+        struct AuthStats {
+            AuthStats() : attempts(0), saved(0), cached(0) {}
+
+            int32_t attempts;   // authentication frames sent
+            int32_t saved;      // compared to walking keys[] in table order
+            int32_t cached;     // sectors opened by the per-UID cache
+        };
+
+        static uint8_t SectorOf(uint8_t block) {
+            return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+        }
+
+        // Every frame to the tag goes through here, so reads are counted and failures classified.
+        int Transceive(const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len, int timeout) {
+            frames++;
+            int res = baton->device->TransceiveBytes(tx, tx_len, rx, rx_len, timeout);
+            if (res < 0 && baton->run) baton->stats.Failure(ErrorClass(res));
+            return res;
+        }
+
+        int AuthenticateBlock(uint8_t type, uint8_t block, const uint8_t *key) {
+            uint8_t command[2 + sizeof(struct mifare_param_auth)], abtRx[MAX_FRAME_LENGTH];
+            uint8_t uid[sizeof baton->nt.nti.nai.abtUid];
+            size_t uid_len = baton->nt.nti.nai.szUidLen;
+            struct mifare_param_auth auth_params;
+
+            memcpy(uid, baton->nt.nti.nai.abtUid, sizeof uid);
+            command[0] = type;
+            command[1] = block;
+            memcpy(auth_params.abtKey, key, sizeof auth_params.abtKey);
+            memcpy(auth_params.abtAuthUid, uid + uid_len - 4, sizeof auth_params.abtAuthUid);
+            memcpy(command + 2, &auth_params, sizeof auth_params);
+
+            int res = Transceive(command, sizeof command, abtRx, sizeof abtRx, -1);
+            if (res < 0 && baton->run) Reselect(); //a failed authentication halts the card.
+            return res;
+        }
+
+        // Tries the sector hint (or the preferred key), then the key that last opened this sector of this card,
+        // then the dictionary ordered by how often each key has worked in this deployment.
+        int Authenticate(uint8_t block, AuthStats &stats, const KeyDictionary::Hint *preferred = NULL) {
+            const KeyDictionary &dictionary = baton->options.dictionary;
+            const uint8_t *uid = baton->nt.nti.nai.abtUid;
+            size_t uid_len = baton->nt.nti.nai.szUidLen, num_keys = dictionary.NumKeys(), i, t;
+            uint8_t sector = SectorOf(block), type = 0, key[6];
+            uint8_t tried_type[2] = { 0, 0 }, tried_key[2][6];
+            size_t tried = 0;
+            int32_t attempts = 0;
+            int res = -1;
+
+            const KeyDictionary::Hint *hint = dictionary.SectorHint(sector);
+            if (!hint) hint = preferred;
+            if (hint) {
+                attempts++;
+                tried_type[tried] = hint->type;
+                memcpy(tried_key[tried++], hint->key, 6);
+                if ((res = AuthenticateBlock(hint->type, block, hint->key)) >= 0) {
+                    type = hint->type;
+                    memcpy(key, hint->key, sizeof key);
+                }
+            }
+
+            if (res < 0 && baton->run && baton->options.use_key_cache && key_cache.Lookup(uid, uid_len, sector, &type, key)) {
+                attempts++;
+                tried_type[tried] = type;
+                memcpy(tried_key[tried++], key, 6);
+                res = AuthenticateBlock(type, block, key);
+                if (res >= 0) stats.cached++;
+                else key_cache.Forget(uid, uid_len, sector);
+            }
+
+            if (res < 0) {
+                if (key_order.size() < num_keys) key_order.resize(num_keys);
+                key_cache.Order(&dictionary.keys[0], num_keys, &key_order[0]);
+                for (i = 0; i < num_keys && res < 0 && baton->run; i++) {
+                    const uint8_t *candidate = dictionary.Key(key_order[i]);
+                    for (t = 0; t < dictionary.num_types && baton->run; t++) {
+                        size_t j;
+                        for (j = 0; j < tried; j++) {
+                            if (tried_type[j] == dictionary.types[t] && memcmp(tried_key[j], candidate, 6) == 0) break;
+                        }
+                        if (j < tried) continue;
+
+                        attempts++;
+                        if ((res = AuthenticateBlock(dictionary.types[t], block, candidate)) >= 0) {
+                            type = dictionary.types[t];
+                            memcpy(key, candidate, sizeof key);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // what walking the dictionary in order would have cost.
+            int32_t baseline = num_keys * dictionary.num_types;
+            if (res >= 0) {
+                for (i = 0; i < num_keys * dictionary.num_types; i++) {
+                    if (dictionary.types[i % dictionary.num_types] == type
+                          && memcmp(dictionary.Key(i / dictionary.num_types), key, sizeof key) == 0) {
+                        baseline = i + 1;
+                        break;
+                    }
+                }
+                if (baton->options.use_key_cache) key_cache.Store(uid, uid_len, sector, type, key);
+                key_cache.RecordSuccess(key);
+            }
+            stats.attempts += attempts;
+            stats.saved += baseline - attempts;
+            return res;
+        }
+
+        static uint8_t TrailerOf(uint8_t sector) {
+            return sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+        }
+
+        const char *StrError() {
+            return baton->device->StrError();
+        }
+
+        bool IsClassic() const {
+            if (baton->nt.nm.nmt != NMT_ISO14443A) return false;
+            return baton->nt.nti.nai.abtAtqa[1] == 0x04 || baton->nt.nti.nai.abtAtqa[1] == 0x02;
+        }
+
+        // Last block of a MIFARE Classic card by SAK (NXP AN10833), 0 when the SAK
+        // can't tell a 1K from a 2K card and the ATS has to decide.
+        static uint8_t ClassicLastBlock(uint8_t sak) {
+            switch (sak) {
+                case 0x09:                                  return 0x13;    // Mini, 320b
+                case 0x01:                                  return 0x3f;    // 1Kb
+                case 0x08: case 0x88:                       return 0;       // 1Kb, or MIFARE Plus 2Kb in SL1
+                case 0x10: case 0x19:                       return 0x7f;    // 2Kb
+                case 0x11: case 0x18: case 0x38: case 0x98: return 0xff;    // 4Kb
+                default:                                    return 0;
+            }
+        }
+
+        // ATS (without its length byte) whose historical bytes c1 05 2f 2f mark a 2Kb card.
+        static bool Is2KAts(const uint8_t *ats, size_t len) {
+            return len >= 9 && ats[4] == 0xc1 && ats[5] == 0x05 && ats[6] == 0x2f && ats[7] == 0x2f;
+        }
+
+        bool IsUltralight() const {
+            return baton->nt.nm.nmt == NMT_ISO14443A && baton->nt.nti.nai.abtAtqa[1] == 0x44;
+        }
+
+        // Reads the flagged blocks to data + 16 * block, authenticating each sector once.
+        // On failure result holds the error, it is left empty when the tag just left the field.
+        int ReadClassicBlocks(const bool *wanted, size_t count, uint8_t *data, AuthStats &auth,
+                              const KeyDictionary::Hint *preferred, char *result, size_t result_size) {
+            uint8_t command[2];
+            int authed = -1, res;
+            size_t block;
+
+            result[0] = '\0';
+            for (block = 0; block < count && baton->run; block++) {
+                if (!wanted[block]) continue;
+
+                if (SectorOf(block) != authed) {
+                    res = Authenticate(TrailerOf(SectorOf(block)), auth, preferred);
+                    if (!baton->run) break;
+                    if (res < 0) {
+                        snprintf(result, result_size, "unable to authenticate sector %d", SectorOf(block));
+                        return res;
+                    }
+                    authed = SectorOf(block);
+                }
+
+                command[0] = MC_READ;
+                command[1] = block;
+                res = Transceive(command, 2, data + 16 * block, 16, -1);
+                if (res >= 0) continue;
+
+                if (res != NFC_ERFTRANS) {
+                    snprintf(result, result_size, "nfc_initiator_transceive_bytes: %s", baton->device->StrError());
+                }
+                return res;
+            }
+            return baton->run ? 0 : NFC_EOPABORTED;
+        }
+
+        // Follows the MAD (MAD2 on cards with more than 16 sectors) and flags the data
+        // blocks of the sectors it assigns to NDEF.
+        int ClassicNdefBlocks(int last_block, bool *wanted, AuthStats &auth, char *result, size_t result_size) {
+            uint8_t image[MAX_TAG_DATA];
+            bool mad[256];
+            size_t count = last_block + 1;
+            int res, sector, sectors = last_block < 128 ? (last_block + 1) / 4 : 32 + (last_block + 1 - 128) / 16;
+
+            memset(mad, 0, sizeof mad);
+            mad[1] = mad[2] = mad[3] = true;
+            if ((res = ReadClassicBlocks(mad, count, image, auth, &mad_key, result, result_size)) < 0) return res;
+
+            uint8_t gpb = image[3 * 16 + 9];
+            if ((gpb & 0x80) == 0) {
+                snprintf(result, result_size, "no MAD on card");
+                return NFC_ENOTIMPL;
+            }
+            if ((gpb & 0x03) == 0x02 && sectors > 16) {
+                memset(mad, 0, sizeof mad);
+                mad[64] = mad[65] = mad[66] = true;
+                if ((res = ReadClassicBlocks(mad, count, image, auth, &mad_key, result, result_size)) < 0) return res;
+            } else if (sectors > 16) sectors = 16;
+
+            memset(wanted, 0, count);
+            for (sector = 1; sector < sectors; sector++) {
+                if (sector == 16) continue; //MAD2 itself
+                // AIDs are stored application code first, the NDEF AID 0x03e1 reads 03 e1.
+                const uint8_t *entry = sector < 16 ? image + 16 + 2 * sector : image + 64 * 16 + 2 + 2 * (sector - 17);
+                if (entry[0] != 0x03 || entry[1] != 0xe1) continue;
+
+                for (int block = TrailerOf(sector) - (sector < 32 ? 3 : 15); block < TrailerOf(sector); block++) wanted[block] = true;
+            }
+            return 0;
+        }
+
+        // Copies the data blocks of the NDEF sectors (trailers left out) to data, so
+        // the result is the contiguous NDEF TLV area.
+        int ReadClassicNdef(int last_block, uint8_t *data, size_t *len, AuthStats &auth, char *result, size_t result_size) {
+            uint8_t image[MAX_TAG_DATA];
+            bool wanted[256];
+            size_t count = last_block + 1, block;
+            int res;
+
+            if ((res = ClassicNdefBlocks(last_block, wanted, auth, result, result_size)) < 0) return res;
+            if ((res = ReadClassicBlocks(wanted, count, image, auth, &ndef_key, result, result_size)) < 0) return res;
+
+            for (block = 0, *len = 0; block < count; block++) {
+                if (!wanted[block]) continue;
+                memcpy(data + *len, image + 16 * block, 16);
+                *len += 16;
+            }
+            return 0;
+        }
+
+        // GET_VERSION reports the real size of Ultralight EV1 and NTAG parts, which also
+        // support FAST_READ. Plain Ultralight and Ultralight C reject it (and halt), so
+        // they are reselected and read as the original 16 pages.
+        size_t ProbeUltralight() {
+            if (ultralight_pages) return ultralight_pages;
+
+            uint8_t command[1] = { UL_GET_VERSION }, version[8];
+            int res = Transceive(command, sizeof command, version, sizeof version, -1);
+
+            fast_read = false;
+            ultralight_pages = 0x10;
+            if (res == sizeof version && version[0] == 0x00 && version[1] == 0x04) {
+                fast_read = true;
+                switch (version[6]) {
+                    case 0x0b: ultralight_pages = 20;  break;   // Ultralight EV1 MF0UL11, NTAG210
+                    case 0x0e: ultralight_pages = 41;  break;   // Ultralight EV1 MF0UL21, NTAG212
+                    case 0x0f: ultralight_pages = 45;  break;   // NTAG213
+                    case 0x11: ultralight_pages = 135; break;   // NTAG215
+                    case 0x13: ultralight_pages = 231; break;   // NTAG216
+                    default:   break;
+                }
+            } else if (baton->run) {
+                Reselect();
+            }
+            return ultralight_pages;
+        }
+
+        // Pages are copied to data + 4 * page. FAST_READ fetches up to MAX_FAST_READ_PAGES
+        // per frame, READ falls back to 4 pages (16 bytes) per frame.
+        int ReadUltralightPages(size_t first, size_t last, uint8_t *data, char *result, size_t result_size) {
+            uint8_t command[3], rx[MAX_FAST_READ_PAGES * 4];
+            size_t page, count;
+            int res;
+
+            ProbeUltralight();
+
+            result[0] = '\0';
+            for (page = first; page <= last && baton->run; page += count) {
+                count = last - page + 1;
+                if (fast_read) {
+                    if (count > MAX_FAST_READ_PAGES) count = MAX_FAST_READ_PAGES;
+                    command[0] = UL_FAST_READ;
+                    command[1] = page;
+                    command[2] = page + count - 1;
+                    res = Transceive(command, 3, rx, count * 4, -1);
+                    if (res == (int) (count * 4)) {
+                        memcpy(data + 4 * page, rx, count * 4);
+                        continue;
+                    }
+                    if (res >= 0) res = NFC_EIO;
+                } else {
+                    if (count > 4) count = 4;
+                    command[0] = MC_READ;
+                    command[1] = page;
+                    res = Transceive(command, 2, rx, 16, -1);
+                    if (res >= 0) {
+                        memcpy(data + 4 * page, rx, count * 4);
+                        continue;
+                    }
+                }
+
+                if (res != NFC_ERFTRANS) {
+                    snprintf(result, result_size, "nfc_initiator_transceive_bytes: %s", baton->device->StrError());
+                }
+                return res;
+            }
+            return baton->run ? 0 : NFC_EOPABORTED;
+        }
+
+        // Last block by SAK, or by ATQA when the SAK is ambiguous (2K cards are then taken for 1K).
+        uint8_t ClassicGuessLastBlock() const {
+            uint8_t last_block = ClassicLastBlock(baton->nt.nti.nai.btSak);
+            if (last_block) return last_block;
+            return (baton->nt.nti.nai.abtAtqa[1] & 0x02) == 0x02 ? 0xff : 0x3f;
+        }
+
+        // Blocks on the selected Classic card: by SAK, ATS or the RATS probe of an earlier read, else guessed.
+        size_t ClassicBlockCount() {
+            const nfc_iso14443a_info &nai = baton->nt.nti.nai;
+            uint8_t last_block = ClassicLastBlock(nai.btSak);
+            if (!last_block && nai.szAtsLen > 0 && Is2KAts(nai.abtAts, nai.szAtsLen)) last_block = 0x7f;
+            if (!last_block) {
+                std::map<std::string, uint8_t>::const_iterator known = geometry.find(std::string((const char *) nai.abtUid, nai.szUidLen));
+                if (known != geometry.end()) last_block = known->second;
+            }
+            if (!last_block) last_block = ClassicGuessLastBlock();
+            return (size_t) last_block + 1;
+        }
+
+        // Writes the flagged blocks from image + 16 * block, authenticating each sector once.
+        // Rewriting a trailer changes the sector keys, so the cached key is dropped.
+        int WriteClassicBlocks(const bool *wanted, size_t count, const uint8_t *image, AuthStats &auth,
+                               const KeyDictionary::Hint *preferred, char *result, size_t result_size) {
+            uint8_t command[2 + 16], rx[MAX_FRAME_LENGTH];
+            int authed = -1, res;
+            size_t block;
+
+            result[0] = '\0';
+            for (block = 0; block < count && baton->run; block++) {
+                if (!wanted[block]) continue;
+
+                if (SectorOf(block) != authed) {
+                    res = Authenticate(TrailerOf(SectorOf(block)), auth, preferred);
+                    if (!baton->run) break;
+                    if (res < 0) {
+                        snprintf(result, result_size, "unable to authenticate sector %d", SectorOf(block));
+                        return res;
+                    }
+                    authed = SectorOf(block);
+                }
+
+                command[0] = MC_WRITE;
+                command[1] = block;
+                memcpy(command + 2, image + 16 * block, 16);
+                res = Transceive(command, sizeof command, rx, sizeof rx, -1);
+                if (res < 0) {
+                    snprintf(result, result_size, "unable to write block %d: %s", (int) block, baton->device->StrError());
+                    if (baton->run) Reselect(); //a refused write halts the card.
+                    return res;
+                }
+
+                if (block == TrailerOf(SectorOf(block))) {
+                    key_cache.Forget(baton->nt.nti.nai.abtUid, baton->nt.nti.nai.szUidLen, SectorOf(block));
+                    authed = -1;
+                }
+            }
+            return baton->run ? 0 : NFC_EOPABORTED;
+        }
+
+        // Writes the flagged pages from image + 4 * page, one WRITE frame per page.
+        int WriteUltralightPages(const bool *wanted, size_t count, const uint8_t *image, char *result, size_t result_size) {
+            uint8_t command[2 + 4], rx[MAX_FRAME_LENGTH];
+            size_t page;
+            int res;
+
+            result[0] = '\0';
+            for (page = 0; page < count && baton->run; page++) {
+                if (!wanted[page]) continue;
+
+                command[0] = UL_WRITE;
+                command[1] = page;
+                memcpy(command + 2, image + 4 * page, 4);
+                res = Transceive(command, sizeof command, rx, sizeof rx, -1);
+                if (res < 0) {
+                    snprintf(result, result_size, "unable to write page %d: %s", (int) page, baton->device->StrError());
+                    if (baton->run) Reselect();
+                    return res;
+                }
+            }
+            return baton->run ? 0 : NFC_EOPABORTED;
+        }
+
+        // Increment, decrement or restore a value block into the card's transfer buffer, transfer it
+        // to block to (same sector), then read the result back. One authentication for the sector.
+        int ValueOperation(mifare_cmd op, uint8_t block, uint32_t operand, uint8_t to, int32_t *value,
+                           AuthStats &auth, char *result, size_t result_size) {
+            uint8_t command[2 + sizeof(struct mifare_param_value)], rx[MAX_FRAME_LENGTH];
+            int res;
+
+            result[0] = '\0';
+            res = Authenticate(TrailerOf(SectorOf(block)), auth);
+            if (!baton->run) return NFC_EOPABORTED;
+            if (res < 0) {
+                snprintf(result, result_size, "unable to authenticate sector %d", SectorOf(block));
+                return res;
+            }
+
+            // restoring a block onto itself changes nothing, so it doesn't spend a write cycle.
+            res = 0;
+            if (op != MC_STORE || to != block) {
+                command[0] = op;
+                command[1] = block;
+                for (int i = 0; i < 4; i++) command[2 + i] = (operand >> (8 * i)) & 0xff;
+                if ((res = Transceive(command, sizeof command, rx, sizeof rx, -1)) >= 0) {
+                    command[0] = MC_TRANSFER;
+                    command[1] = to;
+                    res = Transceive(command, 2, rx, sizeof rx, -1);
+                }
+            }
+            if (res < 0) {
+                snprintf(result, result_size, "value operation on block %d: %s", (int) block, baton->device->StrError());
+                if (baton->run) Reselect(); //a refused operation halts the card.
+                return res;
+            }
+
+            command[0] = MC_READ;
+            command[1] = to;
+            if ((res = Transceive(command, 2, rx, 16, -1)) < 0) {
+                snprintf(result, result_size, "nfc_initiator_transceive_bytes: %s", baton->device->StrError());
+                return res;
+            }
+            if (!DecodeValue(rx, value)) {
+                snprintf(result, result_size, "block %d is not a value block", (int) to);
+                return NFC_EINVARG;
+            }
+            return 0;
+        }
+
+        // value, ~value, value, then the address byte as addr, ~addr, addr, ~addr.
+        static bool DecodeValue(const uint8_t *block, int32_t *value) {
+            for (int i = 0; i < 4; i++) {
+                if (block[i] != block[8 + i] || block[i] != (uint8_t) ~block[4 + i]) return false;
+            }
+            if (block[12] != block[14] || block[13] != block[15] || block[12] != (uint8_t) ~block[13]) return false;
+            *value = (int32_t) (block[0] | (block[1] << 8) | (block[2] << 16) | ((uint32_t) block[3] << 24));
+            return true;
+        }
+
+        void Describe(NFCCard *tag, const nfc_target &nt) {
+            unsigned long cc, n;
+            char *bp;
+            const char *sp;
+
+            tag->SetDevice(device_id, device_name);
+
+            const uint8_t *id;
+            cc = TargetId(nt, &id);
+            char uid[3 * 10];
+            bzero(uid, sizeof uid);
+
+            for (n = 0, bp = uid, sp = ""; n < cc; n++, bp += strlen(bp), sp = ":") {
+                snprintf(bp, sizeof uid - (bp - uid), "%s%02x", sp, id[n]);
+            }
+            tag->SetUID(uid);
+            if (nt.nm.nmt == NMT_ISO14443A) {
+                tag->SetType(nt.nti.nai.abtAtqa[1]);
+                tag->SetTarget(id, cc, nt.nti.nai.abtAtqa, nt.nti.nai.btSak);
+            } else {
+                tag->SetTarget(id, cc, NULL, 0);
+                tag->SetTag(ModulationName(nt.nm.nmt)); //ISO14443A tags are named by ReadTag
+            }
+        }
+
+        void ReadTag(NFCCard *tag) {
+            char result[BUFSIZ];
+            const ReadPlan &plan = baton->options.plan;
+
+            Describe(tag, baton->nt);
+            if (baton->nt.nm.nmt != NMT_ISO14443A) return;
+
+            switch (baton->nt.nti.nai.abtAtqa[1]) {
+                case 0x02:
+                case 0x04:
+                {
+                    tag->SetTag("mifare-classic");
+                    if (plan.mode == READ_UID) break;
+
+                    uint64_t started = uv_hrtime();
+
+                    int res;
+                    uint8_t uiBlocks = ClassicLastBlock(baton->nt.nti.nai.btSak);
+                    std::string signature((const char *) baton->nt.nti.nai.abtUid, baton->nt.nti.nai.szUidLen);
+                    if (!uiBlocks && baton->nt.nti.nai.szAtsLen > 0) {
+                        // the reader already sent RATS during anticollision.
+                        uiBlocks =   Is2KAts(baton->nt.nti.nai.abtAts, baton->nt.nti.nai.szAtsLen) ? 0x7f
+                                   : ((baton->nt.nti.nai.abtAtqa[1] & 0x02) == 0x02)              ? 0xff
+                                   :                                                                0x3f;
+                    }
+                    if (!uiBlocks && geometry.count(signature)) uiBlocks = geometry[signature];
+                    if (!uiBlocks) {
+                        uint64_t probe_started = uv_hrtime();
+
+                        // size guessing logic from nfc-mfclassic.c
+                        uiBlocks =   ((baton->nt.nti.nai.abtAtqa[1] & 0x02) == 0x02) ? 0xff    //  4Kb
+                                   : ((baton->nt.nti.nai.btSak & 0x01) == 0x01)      ? 0x13    // 320b
+                                   :                                                   0x3f;   //  1Kb/2Kb
+                        if (baton->device->SetPropertyBool(NP_EASY_FRAMING, false) < 0) {
+                            snprintf(result, sizeof result, "nfc_device_set_property_bool easyFraming=false: %s",
+                                     baton->device->StrError());
+                            tag->SetError(result);
+                            break;
+                        }
+                        uint8_t abtRats[2] = { 0xe0, 0x50 };
+                        uint8_t abtRx[MAX_FRAME_LENGTH];
+                        res = Transceive(abtRats, sizeof abtRats, abtRx, sizeof abtRx, 0);
+                        if (res > 0) {
+                            int flip;
+
+                            for (flip = 0; flip < 2; flip++) {
+                                if (baton->device->SetPropertyBool(NP_ACTIVATE_FIELD, flip > 0) < 0) {
+                                    snprintf(result, sizeof result, "nfc_device_set_property_bool activateField=%s: %s",
+                                             flip > 0 ? "true" : "false", baton->device->StrError());
+                                    tag->SetError(result);
+                                    break;
+                                }
+                            }
+                            if (flip != 2) break;
+
+                            if (Is2KAts(abtRx + 1, res - 1) && ((baton->nt.nti.nai.abtAtqa[1] & 0x02) == 0x00)) uiBlocks = 0x7f;
+                        }
+                        if (baton->device->SelectPassiveTarget(nmMifare, NULL, 0, &baton->nt) <= 0) {
+                            tag->SetError("unable to reselect tag");
+                            break;
+                        }
+
+                        if (geometry.size() >= 1024) geometry.clear();
+                        geometry[signature] = uiBlocks;
+                        tag->SetProbeTime((uv_hrtime() - probe_started) / 1000);
+                    }
+
+                    if (baton->device->SetPropertyBool(NP_EASY_FRAMING, true) < 0) {
+                        snprintf(result, sizeof result, "nfc_device_set_property_bool easyFraming=false: %s",
+                                 baton->device->StrError());
+                        tag->SetError(result);
+                        break;
+                    }
+
+                    uint8_t *data = tag->Data();
+                    size_t len = 0;
+                    AuthStats auth;
+                    if (plan.mode == READ_NDEF) {
+                        res = ReadClassicNdef(uiBlocks, data, &len, auth, result, sizeof result);
+                    } else {
+                        bool wanted[256] = { false };
+                        plan.Mark(true, wanted, uiBlocks + 1);
+                        for (len = uiBlocks + 1; len > 0 && !wanted[len - 1]; len--);
+                        len *= 16;
+
+                        bzero(data, len);
+                        res = ReadClassicBlocks(wanted, uiBlocks + 1, data, auth, NULL, result, sizeof result);
+                    }
+                    tag->SetAuthStats(auth.attempts, auth.saved, auth.cached);
+                    tag->SetReadTime((uv_hrtime() - started) / 1000);
+                    if (res < 0) {
+                        if (result[0]) tag->SetError(result);
+                        break;
+                    }
+
+                    tag->SetDataSize(len);
+
+                    tag->SetOffset(plan.mode == READ_NDEF ? 0 : 16 * 4);
+                    if (baton->options.parse_ndef) tag->ParseNdef();
+                    break;
+                }
+
+                case 0x44:
+                {
+                    tag->SetTag("mifare-ultralight");
+                    if (plan.mode == READ_UID) break;
+
+                    if (baton->device->SetPropertyBool(NP_EASY_FRAMING, true) < 0) {
+                        snprintf(result, sizeof result, "nfc_device_set_property_bool easyFraming=false: %s",
+                                 baton->device->StrError());
+                        tag->SetError(result);
+                        break;
+                    }
+
+                    int res;
+                    uint8_t *data = tag->Data();
+                    size_t len = 0, pages = ProbeUltralight();
+                    if (plan.mode == READ_NDEF) {
+                        // the capability container in page 3 gives the data area size in units of 8 bytes.
+                        if ((res = ReadUltralightPages(3, 3, data, result, sizeof result)) >= 0) {
+                            if (data[12] != 0xe1) {
+                                snprintf(result, sizeof result, "no NDEF capability container on tag");
+                                res = NFC_ENOTIMPL;
+                            } else {
+                                len = data[14] * 8;
+                                if (len > MAX_TAG_DATA - 16) len = MAX_TAG_DATA - 16;
+                                if (len > 0) res = ReadUltralightPages(4, 3 + (len + 3) / 4, data, result, sizeof result);
+                                memmove(data, data + 16, len);
+                            }
+                        }
+                    } else {
+                        bool wanted[256] = { false };
+                        plan.Mark(false, wanted, pages);
+                        for (; pages > 0 && !wanted[pages - 1]; pages--);
+                        len = pages * 4;
+
+                        bzero(data, len);
+                        size_t first, last;
+                        for (first = 0, res = 0; first < pages && res >= 0; first = last + 1) {
+                            for (; first < pages && !wanted[first]; first++);
+                            for (last = first; last + 1 < pages && wanted[last + 1]; last++);
+                            if (first < pages) res = ReadUltralightPages(first, last, data, result, sizeof result);
+                        }
+                    }
+                    if (res < 0) {
+                        if (result[0]) tag->SetError(result);
+                        break;
+                    }
+
+                    tag->SetDataSize(len);
+
+                    tag->SetOffset(plan.mode == READ_NDEF ? 0 : 16);
+                    if (baton->options.parse_ndef) tag->ParseNdef();
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+
+        // An inventory's reads go to tags, the targets that left to departed.
+        static void AddBatchToNodeObject(NFCCard *batch, Local<Object> object) {
+            Local<Array> tags = Nan::New<Array>(), departed = Nan::New<Array>();
+
+            for(NFCCard *card = batch->Next(); card; card = card->Next()) {
+                Local<Object> entry = Nan::New<Object>();
+                card->AddToNodeObject(entry);
+                if(strcmp(card->Event(), "departed") == 0) Nan::Set(departed, departed->Length(), entry);
+                else Nan::Set(tags, tags->Length(), entry);
+            }
+            Nan::Set(object, Nan::New("tags").ToLocalChecked(), tags);
+            Nan::Set(object, Nan::New("departed").ToLocalChecked(), departed);
+        }
+
+        void HandleProgressCallback() {
+            Nan::HandleScope scope;
+
+            bool stopped = done.load(std::memory_order_acquire);
+
+            // uv_async_send coalesces, so drain everything queued since the last wakeup.
+            NFCCard *tag;
+            while((tag = queue.Pop()) != NULL) {
+                uint64_t popped = uv_hrtime(), found = tag->FoundAt();
+                if(found) baton->stats.queue.Record((popped - tag->QueuedAt()) / 1000);
+
+                Local<Object> object = Nan::New<Object>();
+                tag->AddToNodeObject(object);
+                if(tag->Next()) AddBatchToNodeObject(tag, object);
+
+                Local<Value> argv[2];
+                argv[0] = Nan::New(tag->Event()).ToLocalChecked();
+                argv[1] = object;
+                NFCCard::Dispose(tag);
+
+                async_resource.runInAsyncScope(Nan::New(self), "emit", 2, argv);
+
+                if(found) {
+                    uint64_t now = uv_hrtime();
+                    baton->stats.callback.Record((now - popped) / 1000);
+                    baton->stats.latency.Record((now - found) / 1000);
+                }
+            }
+
+            std::deque<NFCCommand*> finished, abandoned;
+            uv_mutex_lock(&command_mutex);
+            finished.swap(completed);
+            if(stopped) abandoned.swap(commands);
+            uv_mutex_unlock(&command_mutex);
+
+            while(!abandoned.empty()) {
+                abandoned.front()->SetError("NFC device stopped");
+                finished.push_back(abandoned.front());
+                abandoned.pop_front();
+            }
+            while(!finished.empty()) {
+                NFCCommand *command = finished.front();
+                finished.pop_front();
+                command->Complete();
+                delete command;
+            }
+
+            if(stopped) {
+                bool detached = baton->detaching && !baton->lost;
+                if(baton->reader == this) baton->release();
+                HandleOKCallback(detached);
+                Close();
+            }
+        }
+
+      private:
+        NFC *baton;
+        Nan::Persistent<Object> self;
+        Nan::AsyncResource async_resource;
+        uv_thread_t thread;
+        uv_async_t async;
+        uv_mutex_t mutex;
+        uv_cond_t cond;
+        uv_mutex_t command_mutex;
+        std::deque<NFCCommand*> commands;
+        std::deque<NFCCommand*> completed;
+        size_t ultralight_pages;    // 0 until probed for the selected tag
+        int32_t frames;             // exchanged with the current tag
+
+      public:
+        std::atomic<uint64_t> journaled;
+        std::atomic<uint64_t> journal_failures;
+
+      private:
+        char failure[256];          // why Execute gave up, empty when stopped
+        bool fast_read;
+        std::map<std::string, uint8_t> geometry;    // RATS probe results by UID
+        std::vector<size_t> key_order;              // scratch for Authenticate, kept to avoid reallocating
+        nfc_connstring device_id;                   // interned once, every card points at these
+        char device_name[256];
+        RecordPool<NFCCard> records;                // declared before queue, which disposes into it
+        SlabPool *slabs;
+
+      public:
+        TagQueue<NFCCard> queue;
+
+      private:
+        PollSlot slot;              // the reader's turn with the poll scheduler
+        uint64_t next_probe;        // uv_hrtime() the next scheduled probe is due at
+        uint32_t backoff;           // ms, the current idle interval
+        uint64_t burst_until;       // uv_hrtime() the burst after a departure ends at
+        bool device_polls;          // false once the driver turned down PollTarget
+        std::atomic<bool> done;
+    };
+
+
+    class ReadBlocksCommand : public NFCCommand {
+      public:
+        ReadBlocksCommand(Local<Function> callback, uint32_t start, uint32_t count)
+            : NFCCommand(callback), start(start), count(count), size(0) {}
+
+        void Execute(NFCReader *reader) {
+            char result[BUFSIZ];
+            uint8_t image[MAX_TAG_DATA];
+            size_t offset;
+            int res;
+
+            if (reader->IsClassic()) {
+                if ((uint64_t) start + count > reader->ClassicBlockCount()) return SetError("block range is beyond the end of the card");
+
+                NFCReader::AuthStats auth;
+                bool wanted[256] = { false };
+                for (uint32_t block = start; block < start + count; block++) wanted[block] = true;
+                res = reader->ReadClassicBlocks(wanted, start + count, image, auth, NULL, result, sizeof result);
+                offset = 16 * start;
+                size = 16 * count;
+            } else if (reader->IsUltralight()) {
+                if ((uint64_t) start + count > reader->ProbeUltralight()) return SetError("page range is beyond the end of the tag");
+                res = reader->ReadUltralightPages(start, start + count - 1, image, result, sizeof result);
+                offset = 4 * start;
+                size = 4 * count;
+            } else {
+                return SetError("readBlocks is not supported for this tag type");
+            }
+
+            if (res < 0) return SetError(result[0] ? result : "tag left the field");
+            memcpy(data, image + offset, size);
+        }
+
+        Local<Value> Result() {
+            return Nan::CopyBuffer((const char *) data, size).ToLocalChecked();
+        }
+
+      private:
+        uint32_t start;
+        uint32_t count;
+        size_t size;
+        uint8_t data[MAX_TAG_DATA];
+    };
+
+    // write(data, options, callback): a Buffer written from options.start, { <block>: Buffer },
+    // or { ndef: message } for the NDEF area. Blocks are pages on Ultralight. Only blocks that
+    // differ from what is on the tag are written.
+    class WriteCommand : public NFCCommand {
+      public:
+        explicit WriteCommand(Local<Function> callback)
+            : NFCCommand(callback), has_ndef(false), verify(false), force(false), format(false), formatted(false),
+              written(0), unchanged(0), time_us(0) {}
+
+        // JS thread.
+        const char *Parse(Local<Value> data, Local<Object> options) {
+            uint32_t start = 4;
+
+            if (!options.IsEmpty()) {
+                Local<Value> value = Nan::Get(options, Nan::New("start").ToLocalChecked()).ToLocalChecked();
+                if (!value->IsUndefined()) {
+                    if (!value->IsUint32()) return "start option is not a block number";
+                    start = Nan::To<uint32_t>(value).FromJust();
+                }
+                verify = Nan::To<bool>(Nan::Get(options, Nan::New("verify").ToLocalChecked()).ToLocalChecked()).FromJust();
+                force = Nan::To<bool>(Nan::Get(options, Nan::New("force").ToLocalChecked()).ToLocalChecked()).FromJust();
+                format = Nan::To<bool>(Nan::Get(options, Nan::New("format").ToLocalChecked()).ToLocalChecked()).FromJust();
+            }
+
+            if (node::Buffer::HasInstance(data)) return Add(start, data);
+            if (!data->IsObject()) return "data parameter is not a Buffer or an object";
+
+            Local<Object> object = data.As<Object>();
+            Local<Value> message = Nan::Get(object, Nan::New("ndef").ToLocalChecked()).ToLocalChecked();
+            if (!message->IsUndefined()) {
+                if (!node::Buffer::HasInstance(message)) return "ndef is not a Buffer";
+                if (node::Buffer::Length(message) > 0xfffe) return "ndef message is too long";
+
+                // message TLV, with the three byte length form from 255 bytes on, then a terminator.
+                size_t length = node::Buffer::Length(message);
+                const uint8_t *bytes = (const uint8_t *) node::Buffer::Data(message);
+                tlv.push_back(TLV_NDEF);
+                if (length < 0xff) {
+                    tlv.push_back(length);
+                } else {
+                    tlv.push_back(0xff);
+                    tlv.push_back(length >> 8);
+                    tlv.push_back(length & 0xff);
+                }
+                tlv.insert(tlv.end(), bytes, bytes + length);
+                tlv.push_back(TLV_TERMINATOR);
+                has_ndef = true;
+                return NULL;
+            }
+
+            Local<Array> blocks = Nan::GetOwnPropertyNames(object).ToLocalChecked();
+            for (uint32_t i = 0; i < blocks->Length(); i++) {
+                Local<Value> name = Nan::Get(blocks, i).ToLocalChecked();
+                Nan::Utf8String key(name);
+                char *end;
+                unsigned long block = strtoul(*key, &end, 10);
+                if (end == *key || *end || block > 1023) return "data keys must be block numbers";
+
+                const char *err = Add(block, Nan::Get(object, name).ToLocalChecked());
+                if (err) return err;
+            }
+            if (chunks.empty()) return "data has no blocks to write";
+            return NULL;
+        }
+
+        void Execute(NFCReader *reader) {
+            char result[BUFSIZ];
+            uint8_t image[MAX_TAG_DATA], current[MAX_TAG_DATA];
+            bool wanted[256], changed[256];
+            uint64_t started = uv_hrtime();
+            size_t i, block;
+            int res;
+
+            bool classic = reader->IsClassic();
+            if (!classic && !reader->IsUltralight()) return SetError("write is not supported for this tag type");
+            size_t unit = classic ? 16 : 4;
+            size_t count = classic ? reader->ClassicBlockCount() : reader->ProbeUltralight();
+
+            NFCReader::AuthStats auth;
+            const KeyDictionary::Hint *preferred = NULL;
+            memset(image, 0, sizeof image);
+            memset(wanted, 0, sizeof wanted);
+
+            result[0] = '\0';
+            if (has_ndef) {
+                res = classic ? PlanClassicNdef(reader, count, image, wanted, auth, result, sizeof result)
+                              : PlanUltralightNdef(reader, count, image, wanted, result, sizeof result);
+                if (res < 0) return SetError(result[0] ? result : "tag left the field");
+                if (!formatted) preferred = &ndef_key; //freshly formatted sectors still open with transport keys
+            }
+
+            for (i = 0; i < chunks.size(); i++) {
+                const Chunk &chunk = chunks[i];
+                if (chunk.bytes.size() % unit) return SetError(classic ? "data must be whole 16 byte blocks" : "data must be whole 4 byte pages");
+
+                for (block = chunk.first; block < chunk.first + chunk.bytes.size() / unit; block++) {
+                    if (block >= count) return SetError("data runs past the end of the tag");
+                    if (block == 0 || (!classic && block == 1)) return SetError("the manufacturer block can't be written");
+                    if (!force && (classic ? IsTrailer(block) : block < 4)) {
+                        return SetError(classic ? "refusing to write a sector trailer without force"
+                                                : "refusing to write lock or OTP pages without force");
+                    }
+                    wanted[block] = true;
+                }
+                memcpy(image + unit * chunk.first, &chunk.bytes[0], chunk.bytes.size());
+            }
+
+            // trailers always count as changed, key A reads back as zeros.
+            if ((res = ReadMasked(reader, classic, wanted, count, current, auth, preferred, result, sizeof result)) < 0) {
+                return SetError(result[0] ? result : "tag left the field");
+            }
+            for (block = 0; block < count; block++) {
+                changed[block] = wanted[block] && ((classic && IsTrailer(block)) || memcmp(current + unit * block, image + unit * block, unit) != 0);
+                if (!wanted[block]) continue;
+                if (changed[block]) written++;
+                else unchanged++;
+            }
+
+            res = classic ? reader->WriteClassicBlocks(changed, count, image, auth, preferred, result, sizeof result)
+                          : reader->WriteUltralightPages(changed, count, image, result, sizeof result);
+            if (res < 0) return SetError(result[0] ? result : "tag left the field");
+
+            if (verify) {
+                for (block = 0; block < count; block++) if (classic && IsTrailer(block)) changed[block] = false;
+                if ((res = ReadMasked(reader, classic, changed, count, current, auth, preferred, result, sizeof result)) < 0) {
+                    return SetError(result[0] ? result : "tag left the field");
+                }
+                for (block = 0; block < count; block++) {
+                    if (changed[block] && memcmp(current + unit * block, image + unit * block, unit) != 0) {
+                        snprintf(result, sizeof result, "verification failed at block %d", (int) block);
+                        return SetError(result);
+                    }
+                }
+            }
+            time_us = (uv_hrtime() - started) / 1000;
+        }
+
+        Local<Value> Result() {
+            Local<Object> object = Nan::New<Object>();
+            Nan::Set(object, Nan::New("written").ToLocalChecked(), Nan::New<Number>(written));
+            Nan::Set(object, Nan::New("unchanged").ToLocalChecked(), Nan::New<Number>(unchanged));
+            Nan::Set(object, Nan::New("verified").ToLocalChecked(), Nan::New(verify));
+            Nan::Set(object, Nan::New("formatted").ToLocalChecked(), Nan::New(formatted));
+            Nan::Set(object, Nan::New("time").ToLocalChecked(), Nan::New<Number>(time_us));
+            return object;
+        }
+
+      private:
+        struct Chunk {
+            uint32_t first;
+            std::vector<uint8_t> bytes;
+        };
+
+        const char *Add(uint32_t first, Local<Value> data) {
+            if (!node::Buffer::HasInstance(data)) return "data values must be Buffers";
+            if (node::Buffer::Length(data) == 0 || first + node::Buffer::Length(data) / 4 > 1024) return "data is empty or runs past the end of the tag";
+
+            Chunk chunk;
+            const uint8_t *bytes = (const uint8_t *) node::Buffer::Data(data);
+            chunk.first = first;
+            chunk.bytes.assign(bytes, bytes + node::Buffer::Length(data));
+            chunks.push_back(chunk);
+            return NULL;
+        }
+
+        static bool IsTrailer(size_t block) {
+            return block == NFCReader::TrailerOf(NFCReader::SectorOf(block));
+        }
+
+        static int ReadMasked(NFCReader *reader, bool classic, const bool *mask, size_t count, uint8_t *data,
+                              NFCReader::AuthStats &auth, const KeyDictionary::Hint *preferred, char *result, size_t result_size) {
+            if (classic) return reader->ReadClassicBlocks(mask, count, data, auth, preferred, result, result_size);
+
+            size_t first, last;
+            for (first = 0; first < count && !mask[first]; first++);
+            for (last = count; last > first && !mask[last - 1]; last--);
+            result[0] = '\0';
+            return first < last ? reader->ReadUltralightPages(first, last - 1, data, result, result_size) : 0;
+        }
+
+        // The TLV fills the data blocks of the sectors the MAD gives to NDEF, in order. Formatting
+        // claims sectors 1-15 of a 1K card with MAD1 and NFC Forum trailers, so it needs a card
+        // that still opens with the transport keys.
+        int PlanClassicNdef(NFCReader *reader, size_t count, uint8_t *image, bool *wanted,
+                            NFCReader::AuthStats &auth, char *result, size_t result_size) {
+            static const uint8_t mad_trailer[16] = { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0x78, 0x77, 0x88, 0xc1,
+                                                     0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+            static const uint8_t ndef_trailer[16] = { 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7, 0x7f, 0x07, 0x88, 0x40,
+                                                      0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+            bool ndef_blocks[256];
+            size_t block, offset;
+
+            int res = reader->ClassicNdefBlocks(count - 1, ndef_blocks, auth, result, result_size);
+            if (res < 0) {
+                if (!format || res != NFC_ENOTIMPL) return res;
+                if (count != 64) {
+                    snprintf(result, result_size, "formatting is only supported on 1K cards");
+                    return NFC_ENOTIMPL;
+                }
+
+                uint8_t *mad = image + 16;      // blocks 1 and 2: crc, info, then an AID per sector
+                mad[1] = 0x01;
+                for (int sector = 1; sector < 16; sector++) {
+                    mad[2 * sector] = 0x03;
+                    mad[2 * sector + 1] = 0xe1;
+                }
+                mad[0] = MadCrc(mad + 1, 31);
+                memcpy(image + 3 * 16, mad_trailer, 16);
+                wanted[1] = wanted[2] = wanted[3] = true;
+                formatted = true;
+
+                memset(ndef_blocks, 0, sizeof ndef_blocks);
+                for (block = 4; block < 64; block++) {
+                    if (!IsTrailer(block)) ndef_blocks[block] = true;
+                    else {
+                        memcpy(image + 16 * block, ndef_trailer, 16);
+                        wanted[block] = true;
+                    }
+                }
+            }
+
+            for (block = 0, offset = 0; block < count && offset < tlv.size(); block++) {
+                if (!ndef_blocks[block]) continue;
+                memcpy(image + 16 * block, &tlv[offset], tlv.size() - offset < 16 ? tlv.size() - offset : 16);
+                wanted[block] = true;
+                offset += 16;
+            }
+            if (offset < tlv.size()) {
+                snprintf(result, result_size, "NDEF message does not fit on the card");
+                return NFC_EOVFLOW;
+            }
+            return 0;
+        }
+
+        // The TLV starts at page 4, the capability container in page 3 gives the room it has.
+        // Formatting writes the container, which is one time programmable, so it must be blank.
+        int PlanUltralightNdef(NFCReader *reader, size_t count, uint8_t *image, bool *wanted, char *result, size_t result_size) {
+            uint8_t page3[16];
+            size_t page;
+
+            int res = reader->ReadUltralightPages(3, 3, page3, result, result_size);
+            if (res < 0) return res;
+
+            const uint8_t *cc = page3 + 12;
+            if (cc[0] != 0xe1) {
+                if (!format) {
+                    snprintf(result, result_size, "tag is not NDEF formatted");
+                    return NFC_ENOTIMPL;
+                }
+                if (cc[0] | cc[1] | cc[2] | cc[3]) {
+                    snprintf(result, result_size, "capability container is not blank");
+                    return NFC_ENOTIMPL;
+                }
+                image[12] = 0xe1;
+                image[13] = 0x10;
+                image[14] = UltralightDataSize(count);
+                image[15] = 0x00;
+                wanted[3] = true;
+                formatted = true;
+                cc = image + 12;
+            }
+
+            if (tlv.size() > (size_t) cc[2] * 8 || 4 + (tlv.size() + 3) / 4 > count) {
+                snprintf(result, result_size, "NDEF message does not fit on the tag");
+                return NFC_EOVFLOW;
+            }
+            memcpy(image + 16, &tlv[0], tlv.size());
+            for (page = 4; page < 4 + (tlv.size() + 3) / 4; page++) wanted[page] = true;
+            return 0;
+        }
+
+        // Data area size in units of 8 bytes, by the page count GET_VERSION gave.
+        static uint8_t UltralightDataSize(size_t pages) {
+            switch (pages) {
+                case 41:  return 0x10;  // Ultralight EV1 MF0UL21, NTAG212
+                case 45:  return 0x12;  // NTAG213
+                case 135: return 0x3e;  // NTAG215
+                case 231: return 0x6d;  // NTAG216
+                default:  return 0x06;  // 48 bytes: Ultralight, Ultralight EV1 MF0UL11, NTAG210
+            }
+        }
+
+        // MAD CRC-8, polynomial x^8 + x^4 + x^3 + x^2 + 1 preset to 0xc7 (NXP AN10787).
+        static uint8_t MadCrc(const uint8_t *data, size_t len) {
+            uint8_t crc = 0xc7;
+            for (size_t i = 0; i < len; i++) {
+                crc ^= data[i];
+                for (int bit = 0; bit < 8; bit++) crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x1d) : (uint8_t) (crc << 1);
+            }
+            return crc;
+        }
+
+        std::vector<Chunk> chunks;
+        std::vector<uint8_t> tlv;
+        bool has_ndef;
+        bool verify;
+        bool force;
+        bool format;
+        bool formatted;
+        size_t written;
+        size_t unchanged;
+        uint64_t time_us;
+    };
+
+    // increment/decrement/restore, the value ends up in block to once the card transfers it.
+    class ValueCommand : public NFCCommand {
+      public:
+        ValueCommand(Local<Function> callback, mifare_cmd op, uint32_t block, uint32_t operand, uint32_t to)
+            : NFCCommand(callback), op(op), block(block), operand(operand), to(to), value(0), time_us(0) {}
+
+        void Execute(NFCReader *reader) {
+            char result[BUFSIZ];
+            uint64_t started = uv_hrtime();
+
+            if (!reader->IsClassic()) return SetError("value blocks are only supported on MIFARE Classic");
+            if (block >= reader->ClassicBlockCount() || to >= reader->ClassicBlockCount()) return SetError("block is beyond the end of the card");
+            if (block == 0 || block == NFCReader::TrailerOf(NFCReader::SectorOf(block)) || to == NFCReader::TrailerOf(NFCReader::SectorOf(to))) {
+                return SetError("value blocks can't be the manufacturer block or a sector trailer");
+            }
+            if (NFCReader::SectorOf(block) != NFCReader::SectorOf(to)) return SetError("transfer block must be in the same sector");
+
+            NFCReader::AuthStats auth;
+            int res = reader->ValueOperation(op, block, operand, to, &value, auth, result, sizeof result);
+            if (res < 0) return SetError(result[0] ? result : "tag left the field");
+            time_us = (uv_hrtime() - started) / 1000;
+        }
+
+        Local<Value> Result() {
+            Local<Object> object = Nan::New<Object>();
+            Nan::Set(object, Nan::New("value").ToLocalChecked(), Nan::New<Int32>(value));
+            Nan::Set(object, Nan::New("block").ToLocalChecked(), Nan::New<Int32>((int32_t) to));
+            Nan::Set(object, Nan::New("time").ToLocalChecked(), Nan::New<Number>(time_us));
+            return object;
+        }
+
+      private:
+        mifare_cmd op;
+        uint32_t block;
+        uint32_t operand;
+        uint32_t to;
+        int32_t value;
+        uint64_t time_us;
+    };
+
+    // transceive(script, callback): frames sent to the selected tag one after the other on the reader
+    // thread. A step is a Buffer or { data: Buffer, expect: sw or [ sw, ... ], abort: true, timeout: ms };
+    // a response that doesn't end in an expected status word stops the script unless abort is false.
+    class TransceiveCommand : public NFCCommand {
+      public:
+        #define MAX_SCRIPT_STEPS 256
+
+        explicit TransceiveCommand(Local<Function> callback) : NFCCommand(callback), failed(-1), time_us(0) {}
+
+        // JS thread.
+        const char *Parse(Local<Value> script) {
+            if (!script->IsArray() || script.As<Array>()->Length() == 0) return "script parameter is not a non-empty array";
+            Local<Array> array = script.As<Array>();
+            if (array->Length() > MAX_SCRIPT_STEPS) return "script has more than 256 steps";
+
+            steps.resize(array->Length());
+            for (uint32_t i = 0; i < array->Length(); i++) {
+                Step &step = steps[i];
+                Local<Value> entry = Nan::Get(array, i).ToLocalChecked(), frame = entry;
+
+                if (!node::Buffer::HasInstance(entry)) {
+                    if (!entry->IsObject()) return "script steps must be Buffers or objects";
+                    Local<Object> object = entry.As<Object>();
+                    frame = Nan::Get(object, Nan::New("data").ToLocalChecked()).ToLocalChecked();
+
+                    Local<Value> value = Nan::Get(object, Nan::New("expect").ToLocalChecked()).ToLocalChecked();
+                    if (!value->IsUndefined()) {
+                        Local<Array> words = Nan::New<Array>();
+                        if (value->IsArray()) words = value.As<Array>();
+                        else Nan::Set(words, 0, value);
+                        for (uint32_t w = 0; w < words->Length(); w++) {
+                            Local<Value> word = Nan::Get(words, w).ToLocalChecked();
+                            if (!word->IsUint32() || Nan::To<uint32_t>(word).FromJust() > 0xffff) return "expect must be status words (e.g. 0x9000)";
+                            step.expect.push_back(Nan::To<uint32_t>(word).FromJust());
+                        }
+                    }
+
+                    value = Nan::Get(object, Nan::New("abort").ToLocalChecked()).ToLocalChecked();
+                    if (!value->IsUndefined()) step.abort = Nan::To<bool>(value).FromJust();
+
+                    value = Nan::Get(object, Nan::New("timeout").ToLocalChecked()).ToLocalChecked();
+                    if (!value->IsUndefined()) {
+                        if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() > 60000) return "timeout must be 0 to 60000 ms";
+                        step.timeout = Nan::To<uint32_t>(value).FromJust();
+                    }
+                }
+
+                if (!node::Buffer::HasInstance(frame)) return "script step data is not a Buffer";
+                size_t length = node::Buffer::Length(frame);
+                if (length == 0 || length > MAX_FRAME_LENGTH) return "script frames must be 1 to 264 bytes";
+                const uint8_t *bytes = (const uint8_t *) node::Buffer::Data(frame);
+                step.tx.assign(bytes, bytes + length);
+            }
+            data.reserve(steps.size() * MAX_FRAME_LENGTH);
+            return NULL;
+        }
+
+        void Execute(NFCReader *reader) {
+            char result[BUFSIZ];
+            uint8_t rx[MAX_FRAME_LENGTH];
+            uint64_t started = uv_hrtime();
+
+            for (size_t i = 0; i < steps.size(); i++) {
+                const Step &step = steps[i];
+                int res = reader->Transceive(&step.tx[0], step.tx.size(), rx, sizeof rx, step.timeout);
+                if (res < 0) {
+                    snprintf(result, sizeof result, "step %u: nfc_initiator_transceive_bytes: %s", (unsigned) i, reader->StrError());
+                    return SetError(result);
+                }
+
+                data.insert(data.end(), rx, rx + res);
+                lengths.push_back(res);
+
+                if (step.expect.empty()) continue;
+                uint32_t sw = res >= 2 ? (rx[res - 2] << 8 | rx[res - 1]) : 0x10000;
+                if (std::find(step.expect.begin(), step.expect.end(), sw) == step.expect.end() && step.abort) {
+                    failed = (int32_t) i;
+                    break;
+                }
+            }
+            time_us = (uv_hrtime() - started) / 1000;
+        }
+
+        // { data: every response back to back, lengths: [ ... ], failed: step that stopped the script or -1 }
+        Local<Value> Result() {
+            Local<Object> object = Nan::New<Object>();
+            Local<Array> array = Nan::New<Array>(lengths.size());
+            for (size_t i = 0; i < lengths.size(); i++) Nan::Set(array, i, Nan::New<Int32>((int32_t) lengths[i]));
+
+            Nan::Set(object, Nan::New("data").ToLocalChecked(), Nan::CopyBuffer((const char *) (data.empty() ? NULL : &data[0]), data.size()).ToLocalChecked());
+            Nan::Set(object, Nan::New("lengths").ToLocalChecked(), array);
+            Nan::Set(object, Nan::New("failed").ToLocalChecked(), Nan::New<Int32>(failed));
+            Nan::Set(object, Nan::New("time").ToLocalChecked(), Nan::New<Number>(time_us));
+            return object;
+        }
+
+      private:
+        struct Step {
+            Step() : abort(true), timeout(-1) {}
+
+            std::vector<uint8_t>    tx;
+            std::vector<uint32_t>   expect;
+            bool                    abort;
+            int                     timeout;    // -1 leaves it to libnfc
+        };
+
+        std::vector<Step> steps;
+        std::vector<uint8_t> data;
+        std::vector<size_t> lengths;
+        int32_t failed;
+        uint64_t time_us;
+    };
+
+    static uv_once_t running_once = UV_ONCE_INIT;
+    static uv_mutex_t running_mutex;
+    static std::set<NFC*> running;
+
+    static std::set<DeviceMonitor*> monitors;
+
+    // Devices whose reader was detached, open and initialized until start() on some thread takes them
+    // over by deviceID. Each keeps the context reference of the reader it came from.
+    struct ParkedDevice {
+        Transport   *device;
+        uv_loop_t   *loop;      // of the thread that detached it, which closes it when it exits
+    };
+    static std::map<std::string, ParkedDevice> parked;
+
+    // One libnfc context for the process, shared by started devices, scans and device monitors.
+    static uv_mutex_t context_mutex;
+    static nfc_context *shared_context = NULL;
+    static size_t context_refs = 0;
+
+    static void InitRunning() {
+        uv_mutex_init(&running_mutex);
+        uv_mutex_init(&context_mutex);
+#if !NFC_ENV_CLEANUP_HOOKS
+        node::AtExit(NFC::AtExit);
+        node::AtExit(DeviceMonitor::AtExit);
+#endif
+    }
+
+    static nfc_context *AcquireContext() {
+        uv_once(&running_once, InitRunning);
+
+        uv_mutex_lock(&context_mutex);
+        if (context_refs == 0) nfc_init(&shared_context);
+        if (shared_context) context_refs++;
+        nfc_context *context = shared_context;
+        uv_mutex_unlock(&context_mutex);
+        return context;
+    }
+
+    static void ReleaseContext() {
+        uv_mutex_lock(&context_mutex);
+        if (--context_refs == 0) {
+            nfc_exit(shared_context);
+            shared_context = NULL;
+        }
+        uv_mutex_unlock(&context_mutex);
+    }
+
+    // Devices kept open by started NFCs or parked by detach(), they can't be opened a second time.
+    static void HeldDevices(std::set<std::string> &held) {
+        uv_mutex_lock(&running_mutex);
+        for (std::set<NFC*>::iterator it = running.begin(); it != running.end(); it++) {
+            if ((*it)->device && !(*it)->lost) held.insert((*it)->device->Connstring());
+        }
+        for (std::map<std::string, ParkedDevice>::iterator it = parked.begin(); it != parked.end(); it++) held.insert(it->first);
+        uv_mutex_unlock(&running_mutex);
+    }
+
+    static Local<Object> DeviceInfoToNode(const DeviceInfo &device) {
+        Local<Object> info = Nan::New<Object>();
+
+        for (size_t i = 0; i < device.lines.size(); i++) {
+            const DeviceInfoLine &line = device.lines[i];
+            if (line.key.empty()) {
+                Nan::Set(info, line.index, Nan::New(line.value).ToLocalChecked());
+                continue;
+            }
+            if (!line.has_modulations) {
+                Nan::Set(info, Nan::New(line.key).ToLocalChecked(), Nan::New(line.value).ToLocalChecked());
+                continue;
+            }
+
+            Local<Object> modulations = Nan::New<Object>();
+            for (size_t j = 0; j < line.modulations.size(); j++) {
+                const DeviceInfoLine::Modulation &modulation = line.modulations[j];
+                if (modulation.protocol.empty()) {
+                    Nan::Set(modulations, modulation.index, Nan::New(modulation.speeds[0]).ToLocalChecked());
+                    continue;
+                }
+                Local<Array> speeds = Nan::New<Array>();
+                for (size_t k = 0; k < modulation.speeds.size(); k++) Nan::Set(speeds, k, Nan::New(modulation.speeds[k]).ToLocalChecked());
+                Nan::Set(modulations, Nan::New(modulation.protocol).ToLocalChecked(), speeds);
+            }
+            Nan::Set(info, Nan::New(line.key).ToLocalChecked(), modulations);
+        }
+        return info;
+    }
+
+    static void Describe(Transport *device, DeviceInfo &info) {
+        std::string text;
+        info.connstring = device->Connstring();
+        info.name = device->Name();
+        info.Parse(device->InformationAbout(text) >= 0 ? text.c_str() : "");
+        info.ok = true;
+    }
+
+    // Puts an opened device's info into the cache, the reader keeps the device to itself afterwards.
+    static void CacheDeviceInfo(Transport *device) {
+        DeviceInfo info;
+        if (device_cache.Lookup(device->Connstring(), info)) return;
+
+        Describe(device, info);
+        device_cache.Store(info);
+    }
+
+    // Lists the attached devices and probes those that are not cached, each on its own thread.
+    // Devices held open by a started NFC are never opened a second time,
+    // they are reported busy with the info cached when they were started.
+    class ScanJob {
+      public:
+        explicit ScanJob(bool refresh) : refresh(refresh), error(NULL), async_resource("nfc:scan") {}
+
+        void Execute() {
+            nfc_context *context = AcquireContext();
+            if (context == NULL) {
+                error = "unable to init libfnc (malloc).";
+                return;
+            }
+            nfc_connstring connstrings[MAX_DEVICE_COUNT];
+            size_t i, n = nfc_list_devices(context, connstrings, MAX_DEVICE_COUNT);
+
+            std::set<std::string> held;
+            HeldDevices(held);
+
+            std::vector<std::string> listed(connstrings, connstrings + n);
+            device_cache.Refresh(listed, held);
+            if (refresh) device_cache.Clear(held);
+
+            devices.resize(n);
+            for (i = 0; i < n; i++) {
+                Device &device = devices[i];
+                device.info.connstring = listed[i];
+                device.info.ok = false;
+                device.busy = held.count(listed[i]) > 0;
+                device.probing = false;
+                if (device_cache.Lookup(listed[i], device.info) || device.busy) continue;
+
+                device.probing = uv_thread_create(&device.thread, Probe, &device.info) == 0;
+                if (!device.probing) Probe(&device.info);
+            }
+            for (i = 0; i < n; i++) {
+                if (devices[i].probing) uv_thread_join(&devices[i].thread);
+                if (devices[i].info.ok && !devices[i].busy) device_cache.Store(devices[i].info);
+            }
+            ReleaseContext();
+        }
+
+        Local<Value> Result() {
+            Local<Object> object = Nan::New<Object>();
+            for (size_t i = 0; i < devices.size(); i++) {
+                const Device &device = devices[i];
+                if (!device.info.ok && !device.busy) continue; //could not be opened
+
+                Local<Object> entry = Nan::New<Object>();
+                Nan::Set(entry, Nan::New("name").ToLocalChecked(), Nan::New(device.info.name).ToLocalChecked());
+                Nan::Set(entry, Nan::New("info").ToLocalChecked(), DeviceInfoToNode(device.info));
+                if (device.busy) Nan::Set(entry, Nan::New("busy").ToLocalChecked(), Nan::New(true));
+                Nan::Set(object, Nan::New(device.info.connstring).ToLocalChecked(), entry);
+            }
+            return object;
+        }
+
+        const char *Error() const {
+            return error;
+        }
+
+        // Runs Execute on a thread of its own and calls back on the JS thread.
+        int Start(Local<Function> callback) {
+            this->callback.SetFunction(callback);
+            uv_async_init(Nan::GetCurrentEventLoop(), &async, HandleAsync);
+            async.data = this;
+            int res = uv_thread_create(&thread, Run, this);
+            if (res != 0) uv_close((uv_handle_t*)&async, HandleClose);
+            return res;
+        }
+
+      private:
+        struct Device {
+            DeviceInfo  info;
+            bool        busy;
+            bool        probing;
+            uv_thread_t thread;
+        };
+
+        static void Probe(void *arg) {
+            DeviceInfo *info = static_cast<DeviceInfo*>(arg);
+
+            Transport *device = Transport::Open(shared_context, info->connstring.c_str());
+            if (device != NULL) {
+                Describe(device, *info);
+                delete device;
+            }
+        }
+
+        static void Run(void *arg) {
+            ScanJob *job = static_cast<ScanJob*>(arg);
+            job->Execute();
+            uv_async_send(&job->async);
+        }
+
+        static NAUV_WORK_CB(HandleAsync) {
+            ScanJob *job = static_cast<ScanJob*>(async->data);
+            Nan::HandleScope scope;
+
+            uv_thread_join(&job->thread);
+            Local<Value> argv[2];
+            if (job->error) {
+                argv[0] = Nan::Error(job->error);
+                argv[1] = Nan::Undefined();
+            } else {
+                argv[0] = Nan::Null();
+                argv[1] = job->Result();
+            }
+            job->callback.Call(2, argv, &job->async_resource);
+            uv_close((uv_handle_t*)&job->async, HandleClose);
+        }
+
+        static void HandleClose(uv_handle_t *handle) {
+            delete static_cast<ScanJob*>(handle->data);
+        }
+
+        bool refresh;
+        const char *error;
+        std::vector<Device> devices;
+        Nan::Callback callback;
+        Nan::AsyncResource async_resource;
+        uv_thread_t thread;
+        uv_async_t async;
+    };
+
+    // Aborts the reader's poll, if it is in one. Polls that start later see run and paused themselves.
+    void NFC::AbortPoll() {
+        uv_mutex_lock(&poll_mutex);
+        if(polling) {
+            device->AbortCommand();
+            abort_pending = true;
+        }
+        uv_mutex_unlock(&poll_mutex);
+    }
+
+    // Asks the reader thread to wind down, the device is released and "stopped"
+    // is emitted from the reader's async callback once the thread has exited.
+    void NFC::stop() {
+        run = false;
+        if(reader) {
+            reader->queue.Close();
+            reader->Wake();
+        }
+        if(device) device->AbortCommand(); //interrupts an in-flight select or transceive
+    }
+
+    // Like stop(), but the device is parked instead of closed, so only a poll is cut short:
+    // an abort landing between commands would fail the next owner's first frame.
+    void NFC::detach() {
+        detaching = true;
+        run = false;
+        if(reader) {
+            reader->queue.Close();
+            reader->Wake();
+        }
+        if(device) AbortPoll();
+    }
+
+    // JS thread only, after the reader thread has left Execute.
+    void NFC::release() {
+        if(reader) {
+            reader->Join();
+            reader = NULL;
+        }
+
+        //parked in the same step, so the device never looks free to scan() or a DeviceMonitor.
+        bool park = device && detaching && !lost;
+        uv_mutex_lock(&running_mutex);
+        running.erase(this);
+        if(park) {
+            ParkedDevice entry = { device, loop };
+            parked[device->Connstring()] = entry;
+        }
+        uv_mutex_unlock(&running_mutex);
+
+        if(park) context = NULL;    //kept by the parked device
+        else delete device;
+        device = NULL;
+        detaching = false;
+        if(journal) {
+            Journal::Release(journal);
+            journal = NULL;
+        }
+        if(context) {
+            ReleaseContext();
+            context = NULL;
+        }
+    }
+
+    // A device detached on some thread, NULL when none is parked under connstring.
+    static Transport *Unpark(const char *connstring) {
+        Transport *device = NULL;
+
+        uv_mutex_lock(&running_mutex);
+        std::map<std::string, ParkedDevice>::iterator it = parked.find(connstring);
+        if (it != parked.end()) {
+            device = it->second.device;
+            parked.erase(it);
+        }
+        uv_mutex_unlock(&running_mutex);
+        return device;
+    }
+
+    // node (or the worker thread whose loop is arg) is exiting with readers still started,
+    // close their devices cleanly, and the ones detached there that nobody took over.
+    void NFC::AtExit(void *arg) {
+        std::set<NFC*> nfcs;
+        std::vector<Transport*> orphans;
+
+        uv_mutex_lock(&running_mutex);
+        for (std::set<NFC*>::iterator it = running.begin(); it != running.end(); it++) {
+            if (!arg || (*it)->loop == arg) nfcs.insert(*it);
+        }
+        for (std::map<std::string, ParkedDevice>::iterator it = parked.begin(); it != parked.end();) {
+            if (!arg || it->second.loop == arg) {
+                orphans.push_back(it->second.device);
+                parked.erase(it++);
+            } else {
+                it++;
+            }
+        }
+        uv_mutex_unlock(&running_mutex);
+
+        std::set<NFC*>::iterator it;
+        for (it = nfcs.begin(); it != nfcs.end(); it++) {
+            (*it)->detaching = false;
+            (*it)->stop();
+        }
+        for (it = nfcs.begin(); it != nfcs.end(); it++) {
+            NFC *nfc = *it;
+            if (!nfc->reader || nfc->reader->WaitDone(1000 * 1000 * 1000)) nfc->release();
+            else fprintf(stderr, "Node was stopped while some NFC devices where still started.\n");
+        }
+        for (size_t i = 0; i < orphans.size(); i++) {
+            delete orphans[i];
+            ReleaseContext();
+        }
+    }
+
+    NAN_METHOD(NFC::New) {
+        Nan::HandleScope scope;
+        assert(info.IsConstructCall());
+        NFC* self = new NFC();
+        self->Wrap(info.This());
+        info.GetReturnValue().Set(info.This());
+    }
+
+    NAN_METHOD(NFC::Stop) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+        bool pending = nfc->reader != NULL;
+        nfc->stop();
+        info.GetReturnValue().Set(pending); //"stopped" will follow
+
+    }
+
+    // Both return whether the reader was paused before.
+    NAN_METHOD(NFC::Pause) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+        bool was = nfc->paused.exchange(true);
+        if (!was && nfc->run && nfc->reader) nfc->AbortPoll();
+        if (!was && nfc->reader) nfc->reader->Wake(); //gives up a poll slot it is waiting for
+        info.GetReturnValue().Set(was);
+    }
+
+    NAN_METHOD(NFC::Resume) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+        bool was = nfc->paused.exchange(false);
+        if (was && nfc->reader) nfc->reader->Wake();
+        info.GetReturnValue().Set(was);
+    }
+
+    NAN_METHOD(NFC::Detach) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+
+        if (!nfc->reader || !nfc->run) return Nan::ThrowError("NFC device not started");
+        nfc->detach();
+        info.GetReturnValue().Set(Nan::New(nfc->device->Connstring()).ToLocalChecked()); //"detached" will follow
+    }
+
+    NAN_METHOD(NFC::QueueStats) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
 
-        void stop() {
-            run = false;
-            while(claimed);
-            if(pnd) {
-                nfc_abort_command(pnd);
-                nfc_close(pnd);
-                pnd = NULL;
-            }
-            if(context) {
-                nfc_exit(context);
-                context = NULL;
+        Local<Object> object = Nan::New<Object>();
+        if (nfc->reader) {
+            TagQueue<NFCCard> &queue = nfc->reader->queue;
+            Nan::Set(object, Nan::New("capacity").ToLocalChecked(), Nan::New<Number>(queue.Capacity()));
+            Nan::Set(object, Nan::New("depth").ToLocalChecked(), Nan::New<Number>(queue.Depth()));
+            Nan::Set(object, Nan::New("highWater").ToLocalChecked(), Nan::New<Number>(queue.HighWater()));
+            Nan::Set(object, Nan::New("pushed").ToLocalChecked(), Nan::New<Number>(queue.Pushed()));
+            Nan::Set(object, Nan::New("dropped").ToLocalChecked(), Nan::New<Number>(queue.Dropped()));
+            Nan::Set(object, Nan::New("allocations").ToLocalChecked(), Nan::New<Number>(nfc->reader->Allocations()));
+            if (nfc->journal) {
+                Nan::Set(object, Nan::New("journaled").ToLocalChecked(), Nan::New<Number>(nfc->reader->journaled.load()));
+                Nan::Set(object, Nan::New("journalFailures").ToLocalChecked(), Nan::New<Number>(nfc->reader->journal_failures.load()));
             }
         }
+        info.GetReturnValue().Set(object);
+    }
 
-        nfc_device *pnd;
-        nfc_target nt;
-        nfc_context *context;
-        bool run;
-        bool claimed;
-    };
+    static Local<Object> HistogramToNode(const Histogram &histogram) {
+        Histogram::Summary summary;
+        histogram.Summarize(summary);
 
-    class NFCCard {
-      public:
-        NFCCard() {
-            deviceID = name = uid = tag = error = NULL;
-            type = data_size = offset = 0;
-            data = NULL;
-        }
+        Local<Object> object = Nan::New<Object>();
+        Nan::Set(object, Nan::New("count").ToLocalChecked(), Nan::New<Number>(summary.count));
+        Nan::Set(object, Nan::New("mean").ToLocalChecked(), Nan::New<Number>(summary.count ? (double) summary.sum / summary.count : 0));
+        Nan::Set(object, Nan::New("p50").ToLocalChecked(), Nan::New<Number>(summary.p50));
+        Nan::Set(object, Nan::New("p90").ToLocalChecked(), Nan::New<Number>(summary.p90));
+        Nan::Set(object, Nan::New("p99").ToLocalChecked(), Nan::New<Number>(summary.p99));
+        Nan::Set(object, Nan::New("max").ToLocalChecked(), Nan::New<Number>(summary.max));
+        return object;
+    }
 
-        ~NFCCard() {
-            delete deviceID;
-            delete name;
-            delete uid;
-            delete tag;
-            delete error;
-            if(data) delete data;
-        }
+    // stats([options]), options.reset clears the figures once they are read.
+    NAN_METHOD(NFC::Stats) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
 
-        void AddToNodeObject(Local<Object> object) {
-            if(deviceID) object->Set(Nan::New("deviceID").ToLocalChecked(), Nan::New(deviceID).ToLocalChecked());
-            if(name) object->Set(Nan::New("name").ToLocalChecked(), Nan::New(name).ToLocalChecked());
-            if(uid) object->Set(Nan::New("uid").ToLocalChecked(), Nan::New(uid).ToLocalChecked());
-            if(type) object->Set(Nan::New("type").ToLocalChecked(), Nan::New<Int32>(type));
-            if(tag) object->Set(Nan::New("tag").ToLocalChecked(), Nan::New(tag).ToLocalChecked());
-            if(error) object->Set(Nan::New("error").ToLocalChecked(), Nan::Error(error));
-            if(data) object->Set(Nan::New("data").ToLocalChecked(), Nan::NewBuffer(data, data_size).ToLocalChecked());
-            if(offset) object->Set(Nan::New("offset").ToLocalChecked(), Nan::New<Int32>((int32_t)offset));
-            data = NULL; //ownership transferred to nodejs
+        bool reset = false;
+        if (info.Length() > 0 && !info[0]->IsUndefined()) {
+            if (!info[0]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            reset = Nan::To<bool>(Nan::Get(info[0].As<Object>(), Nan::New("reset").ToLocalChecked()).ToLocalChecked()).FromJust();
         }
 
-        void SetDeviceID(const char *deviceID) {
-            if(this->deviceID) delete this->deviceID;
-            this->deviceID = strdup(deviceID);
-        }
-        void SetName(const char *name) {
-            if(this->name) delete this->name;
-            this->name = strdup(name);
-        }
-        void SetUID(const char *uid) {
-            if(this->uid) delete this->uid;
-            this->uid = strdup(uid);
+        ReaderStats &stats = nfc->stats;
+        Local<Object> object = Nan::New<Object>();
+        Nan::Set(object, Nan::New("reads").ToLocalChecked(), Nan::New<Number>(stats.reads.load()));
+        Nan::Set(object, Nan::New("failedReads").ToLocalChecked(), Nan::New<Number>(stats.failed_reads.load()));
+        Nan::Set(object, Nan::New("polls").ToLocalChecked(), Nan::New<Number>(stats.polls.load()));
+        Nan::Set(object, Nan::New("latency").ToLocalChecked(), HistogramToNode(stats.latency));
+        Nan::Set(object, Nan::New("probe").ToLocalChecked(), HistogramToNode(stats.probe));
+        Nan::Set(object, Nan::New("read").ToLocalChecked(), HistogramToNode(stats.read));
+        Nan::Set(object, Nan::New("queue").ToLocalChecked(), HistogramToNode(stats.queue));
+        Nan::Set(object, Nan::New("callback").ToLocalChecked(), HistogramToNode(stats.callback));
+        Nan::Set(object, Nan::New("authAttempts").ToLocalChecked(), HistogramToNode(stats.auth_attempts));
+        Nan::Set(object, Nan::New("frames").ToLocalChecked(), HistogramToNode(stats.frames));
+
+        Local<Object> failures = Nan::New<Object>();
+        for (size_t i = 0; i < num_error_classes; i++) {
+            uint64_t count = stats.failures[i].load();
+            if (count) Nan::Set(failures, Nan::New(error_classes[i].name).ToLocalChecked(), Nan::New<Number>(count));
         }
-        void SetType(int32_t type) {
-            this->type = type;
+        Nan::Set(object, Nan::New("failures").ToLocalChecked(), failures);
+
+        if (reset) stats.Reset();
+        info.GetReturnValue().Set(object);
+    }
+
+    // readBlocks(start, count, callback): blocks on MIFARE Classic, pages on Ultralight.
+    NAN_METHOD(NFC::ReadBlocks) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+
+        if (info.Length() < 3 || !info[2]->IsFunction()) return Nan::ThrowError("callback parameter is not a function");
+        if (!info[0]->IsUint32() || Nan::To<uint32_t>(info[0]).FromJust() > 0xff) return Nan::ThrowError("start parameter is not a block number");
+        if (!info[1]->IsUint32() || Nan::To<uint32_t>(info[1]).FromJust() == 0 || Nan::To<uint32_t>(info[1]).FromJust() > 0x100) {
+            return Nan::ThrowError("count parameter is out of range");  //against the selected tag's size on the reader thread
         }
-        void SetTag(const char *tag) {
-            if(this->tag) delete this->tag;
-            this->tag = strdup(tag);
+        if (!nfc->reader || !nfc->run) return Nan::ThrowError("NFC device not started");
+
+        nfc->reader->Queue(new ReadBlocksCommand(info[2].As<Function>(), Nan::To<uint32_t>(info[0]).FromJust(), Nan::To<uint32_t>(info[1]).FromJust()));
+        info.GetReturnValue().Set(info.This());
+    }
+
+    // write(data, [options], callback), see WriteCommand.
+    NAN_METHOD(NFC::Write) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+
+        int argc = info.Length();
+        if (argc < 2 || !info[argc - 1]->IsFunction()) return Nan::ThrowError("callback parameter is not a function");
+        Local<Object> options;
+        if (argc > 2) {
+            if (!info[1]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            options = info[1].As<Object>();
         }
-        void SetError(const char *error) {
-            if(this->error) delete this->error;
-            this->error = strdup(error);
+        if (!nfc->reader || !nfc->run) return Nan::ThrowError("NFC device not started");
+
+        WriteCommand *command = new WriteCommand(info[argc - 1].As<Function>());
+        const char *err = command->Parse(info[0], options);
+        if (err) {
+            delete command;
+            return Nan::ThrowError(err);
         }
-        void SetOffset(size_t offset) {
-            this->offset = offset;
+        nfc->reader->Queue(command);
+        info.GetReturnValue().Set(info.This());
+    }
+
+    // (block, [amount,] [options,] callback), options.transfer names the block that receives the result.
+    static void QueueValue(Nan::NAN_METHOD_ARGS_TYPE info, mifare_cmd op) {
+        NFC* nfc = Nan::ObjectWrap::Unwrap<NFC>(info.This());
+        int argc = info.Length(), argi = 1;
+        uint32_t operand = 0;
+
+        if (argc < 2 || !info[argc - 1]->IsFunction()) return Nan::ThrowError("callback parameter is not a function");
+        if (!info[0]->IsUint32() || Nan::To<uint32_t>(info[0]).FromJust() > 255) return Nan::ThrowError("block parameter is not a block number");
+        uint32_t block = Nan::To<uint32_t>(info[0]).FromJust(), to = block;
+        if (op != MC_STORE) {
+            if (argc < 3 || !info[argi]->IsUint32() || Nan::To<uint32_t>(info[argi]).FromJust() > 0x7fffffff) {
+                return Nan::ThrowError("amount parameter is not a positive 31 bit integer");
+            }
+            operand = Nan::To<uint32_t>(info[argi++]).FromJust();
         }
-        void SetData(const uint8_t *data, size_t data_size) {
-            if(this->data) free(this->data);
-            this->data_size = data_size;
-            this->data = (char*)malloc(data_size);
-            memcpy(this->data, data, data_size);
+        if (argi < argc - 1) {
+            if (!info[argi]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            Local<Value> value = Nan::Get(info[argi].As<Object>(), Nan::New("transfer").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() > 255) return Nan::ThrowError("transfer option is not a block number");
+                to = Nan::To<uint32_t>(value).FromJust();
+            }
         }
-      private:
-        char        *deviceID;
-        char        *name;
-        char        *uid;
-        int32_t     type;
-        char        *tag;
-        char        *error;
-        size_t      offset;
-        size_t      data_size;
-        char        *data;
-    };
+        if (!nfc->reader || !nfc->run) return Nan::ThrowError("NFC device not started");
 
-    class NFCReadWorker : public Nan::AsyncProgressWorker {
-      public:
-        NFCReadWorker(NFC *baton, Local<Object>self)
-            : Nan::AsyncProgressWorker(new Nan::Callback(self.As<Function>())), baton(baton) {
-                SaveToPersistent("self", self);
-                baton->run = true;
-        }
+        nfc->reader->Queue(new ValueCommand(info[argc - 1].As<Function>(), op, block, operand, to));
+        info.GetReturnValue().Set(info.This());
+    }
 
-        ~NFCReadWorker() {
-            delete callback; //For some reason HandleProgressCallback only fires while callback exists.
-        }
+    NAN_METHOD(NFC::Increment) {
+        Nan::HandleScope scope;
+        QueueValue(info, MC_INCREMENT);
+    }
 
-        void HandleOKCallback() {
-            Local<Value> argv = Nan::New("stopped").ToLocalChecked();
+    NAN_METHOD(NFC::Decrement) {
+        Nan::HandleScope scope;
+        QueueValue(info, MC_DECREMENT);
+    }
+
+    // MIFARE's restore loads a value block unchanged, with transfer this copies it (e.g. to a backup block).
+    NAN_METHOD(NFC::Restore) {
+        Nan::HandleScope scope;
+        QueueValue(info, MC_STORE);
+    }
+
+    NAN_METHOD(NFC::Transceive) {
+        Nan::HandleScope scope;
+        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
+
+        if (info.Length() < 2 || !info[1]->IsFunction()) return Nan::ThrowError("callback parameter is not a function");
+        if (!nfc->reader || !nfc->run) return Nan::ThrowError("NFC device not started");
 
-            Local<Object> self = GetFromPersistent("self").As<Object>();
-            Nan::MakeCallback(self, "emit", 1, &argv);
+        TransceiveCommand *command = new TransceiveCommand(info[1].As<Function>());
+        const char *err = command->Parse(info[0]);
+        if (err) {
+            delete command;
+            return Nan::ThrowError(err);
         }
+        nfc->reader->Queue(command);
+        info.GetReturnValue().Set(info.This());
+    }
 
-        void HandleErrorCallback() {
-            Local<Value> argv[2];
-            argv[0] = Nan::New("error").ToLocalChecked();
-            argv[1] = Nan::Error(AsyncProgressWorker::ErrorMessage());
+    NAN_METHOD(NFC::Start) {
+        Nan::HandleScope scope;
 
-            Local<Object> self = GetFromPersistent("self").As<Object>();
-            Nan::MakeCallback(self, "emit", 2, argv);
-            HandleOKCallback();
+        int argi = 0;
+        Local<Value> deviceID, options;
+        if (info.Length() > argi && !info[argi]->IsObject()) deviceID = info[argi++];
+        if (info.Length() > argi) {
+            if (!info[argi]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            options = info[argi];
         }
 
-        void Execute(const AsyncProgressWorker::ExecutionProgress& progress) {
-            while(baton->run && nfc_initiator_select_passive_target(baton->pnd, nmMifare, NULL, 0, &baton->nt) > 0) {
-                baton->claimed = true;
-                tag = new NFCCard();
-                if(baton->run) ReadTag(tag);
-                baton->claimed = false;
+        NFC *baton = ObjectWrap::Unwrap<NFC>(info.This());
+        if (baton->device) return Nan::ThrowError(baton->run ? "NFC device already started" : "NFC device is still stopping");
+
+        baton->options = NFCOptions();
+        if (!options.IsEmpty()) {
+            const char *err = baton->options.Parse(options.As<Object>());
+            if (err) return Nan::ThrowError(err);
+        }
 
-                progress.Send(NULL, 0);
+        nfc_context *context = AcquireContext();
+        if (context == NULL) return Nan::ThrowError("unable to init libfnc (malloc).");
 
-                int timeout = 5 * 1000; //5 second timeout
-                while(baton->run && tag && --timeout > 0) {
-                    usleep(1000);
-                }
-                if(timeout <= 0) {
-                    //unresponsive VM, node was likely killed while this devide was not stopped.
-                    baton->stop();
-                    baton->run = false;
-                    fprintf(stderr, "Node was stopped while some NFC devices where still started.\n");
-                }
+        Transport *device;
+        if (!deviceID.IsEmpty()) {
+            if (!deviceID->IsString()) {
+                ReleaseContext();
+                return Nan::ThrowError("deviceID parameter is not a string");
             }
+            nfc_connstring connstring;
+            Nan::Utf8String id(deviceID);
+            snprintf(connstring, sizeof connstring, "%s", *id);
+
+            if ((device = Unpark(connstring)) != NULL) ReleaseContext(); //it brings the reference it kept
+            else device = Transport::Open(context, connstring);
+        } else {
+            device = Transport::Open(context, NULL);
+        }
+        if (device == NULL) {
+            ReleaseContext();
+            return Nan::ThrowError("unable open NFC device");
         }
 
-        #define MAX_DEVICE_COUNT 16
-        #define MAX_FRAME_LENGTH 264
+        char result[BUFSIZ];
+        if (device->InitiatorInit() < 0) {
+            snprintf(result, sizeof result, "nfc_initiator_init: %s", device->StrError());
+            delete device;
+            ReleaseContext();
+            return Nan::ThrowError(result);
+        }
 
-        void ReadTag(NFCCard *tag) {
-            unsigned long cc, n;
-            char *bp, result[BUFSIZ];
-            const char *sp;
+        CacheDeviceInfo(device);
+
+        Journal *journal = NULL;
+        if (!baton->options.journal.empty()) {
+            std::string error;
+            journal = Journal::Acquire(baton->options.journal, baton->options.journal_segment_size, baton->options.journal_segments, error);
+            if (journal == NULL) {
+                snprintf(result, sizeof result, "unable to open journal %s", error.c_str());
+                delete device;
+                ReleaseContext();
+                return Nan::ThrowError(result);
+            }
+        }
 
-            tag->SetDeviceID(nfc_device_get_connstring(baton->pnd));
-            tag->SetName(nfc_device_get_name(baton->pnd));
+        baton->context = context;
+        baton->device = device;
+        baton->journal = journal;
+        baton->loop = Nan::GetCurrentEventLoop();
+        baton->paused = baton->options.paused;
+
+        NFCReader *reader = new NFCReader(baton, info.This());
+        if (reader->Start() != 0) {
+            baton->run = false;
+            reader->Close();
+            baton->release();
+            return Nan::ThrowError("unable to start NFC reader thread");
+        }
+        baton->reader = reader;
 
-            cc = baton->nt.nti.nai.szUidLen;
-            if (cc > sizeof baton->nt.nti.nai.abtUid) cc = sizeof baton->nt.nti.nai.abtUid;
-            char uid[3 * sizeof baton->nt.nti.nai.abtUid];
-            bzero(uid, sizeof uid);
+        uv_mutex_lock(&running_mutex);
+        running.insert(baton);
+        uv_mutex_unlock(&running_mutex);
 
-            for (n = 0, bp = uid, sp = ""; n < cc; n++, bp += strlen(bp), sp = ":") {
-                snprintf(bp, sizeof uid - (bp - uid), "%s%02x", sp, baton->nt.nti.nai.abtUid[n]);
-            }
-            tag->SetUID(uid);
-            tag->SetType(baton->nt.nti.nai.abtAtqa[1]);
+        Local<Object> object = Nan::New<Object>();
+        Nan::Set(object, Nan::New("deviceID").ToLocalChecked(), Nan::New(baton->device->Connstring()).ToLocalChecked());
+        Nan::Set(object, Nan::New("name").ToLocalChecked(), Nan::New(baton->device->Name()).ToLocalChecked());
 
-            switch (baton->nt.nti.nai.abtAtqa[1]) {
-                case 0x04:
-                {
-                    tag->SetTag("mifare-classic");
+        info.GetReturnValue().Set(object);
+    }
 
-                    // size guessing logic from nfc-mfclassic.c
-                    uint8_t uiBlocks =   ((baton->nt.nti.nai.abtAtqa[1] & 0x02) == 0x02) ? 0xff    //  4Kb
-                                       : ((baton->nt.nti.nai.btSak & 0x01) == 0x01)      ? 0x13    // 320b
-                                       :                                                   0x3f;   //  1Kb/2Kb
-                    if (nfc_device_set_property_bool(baton->pnd, NP_EASY_FRAMING, false) < 0) {
-                        snprintf(result, sizeof result, "nfc_device_set_property_bool easyFraming=false: %s",
-                                 nfc_strerror(baton->pnd));
-                        tag->SetError(result);
-                        break;
-                    }
-                    uint8_t abtRats[2] = { 0xe0, 0x50 };
-                    uint8_t abtRx[MAX_FRAME_LENGTH];
-                    int res = nfc_initiator_transceive_bytes(baton->pnd, abtRats, sizeof abtRats, abtRx, sizeof abtRx, 0);
-                    if (res > 0) {
-                        int flip;
-
-                        for (flip = 0; flip < 2; flip++) {
-                            if (nfc_device_set_property_bool(baton->pnd, NP_ACTIVATE_FIELD, flip > 0) < 0) {
-                                snprintf(result, sizeof result, "nfc_device_set_property_bool activateField=%s: %s",
-                                         flip > 0 ? "true" : "false", nfc_strerror(baton->pnd));
-                                tag->SetError(result);
-                                break;
-                            }
-                        }
-                        if (flip != 2) break;
-
-                        if ((res >= 10)
-                              && (abtRx[5] == 0xc1)
-                              && (abtRx[6] == 0x05)
-                              && (abtRx[7] == 0x2f)
-                              && (abtRx[8] == 0x2f)
-                              && ((baton->nt.nti.nai.abtAtqa[1] & 0x02) == 0x00)) uiBlocks = 0x7f;
-                    }
-                    if (nfc_initiator_select_passive_target(baton->pnd, nmMifare, NULL, 0, &baton->nt) <= 0) {
-                        tag->SetError("unable to reselect tag");
-                        break;
-                    }
+    void DeviceMonitor::Run(void *arg) {
+        DeviceMonitor *monitor = static_cast<DeviceMonitor*>(arg);
+        monitor->Execute();
+    }
 
-                    if (nfc_device_set_property_bool(baton->pnd, NP_EASY_FRAMING, true) < 0) {
-                        snprintf(result, sizeof result, "nfc_device_set_property_bool easyFraming=false: %s",
-                                 nfc_strerror(baton->pnd));
-                        tag->SetError(result);
-                        break;
-                    }
+    void DeviceMonitor::Execute() {
+        uv_mutex_lock(&mutex);
+        while(run) {
+            uv_mutex_unlock(&mutex);
+            List();
+            uv_mutex_lock(&mutex);
+            if(run) uv_cond_timedwait(&cond, &mutex, (uint64_t) interval * 1000 * 1000);
+        }
+        done = true;
+        uv_mutex_unlock(&mutex);
+        uv_async_send(&async);
+    }
 
-                    int cnt, len;
-                    uint8_t command[MAX_FRAME_LENGTH], data[4 * 1024], *dp;
-                    len = (uiBlocks + 1) * 16;
-                    if (((unsigned long) len) > sizeof data) len = sizeof data;
-                    for (cnt = uiBlocks, dp = data + len - 16;
-                             cnt >= 0;
-                             cnt--, dp -= 16) {
-                        if (((cnt + 1) % (cnt < 128 ? 4 : 16)) == 0) {
-                            size_t key_index;
-                            struct mifare_param_auth auth_params;
-                            for (key_index = 0; key_index < num_keys; key_index++) {
-                                bzero(command, sizeof command);
-                                command[0] = MC_AUTH_B;
-                                command[1] = cnt;
-
-                                bzero(&auth_params, sizeof auth_params);
-                                memcpy(auth_params.abtKey, (uint8_t *) keys + (key_index * 6),
-                                       sizeof auth_params.abtKey);
-                                memcpy(auth_params.abtAuthUid, baton->nt.nti.nai.abtUid + baton->nt.nti.nai.szUidLen - 4,
-                                       sizeof auth_params.abtAuthUid);
-                                memcpy(command + 2, &auth_params, sizeof auth_params);
-
-                                res = nfc_initiator_transceive_bytes(baton->pnd, command, 2 + sizeof auth_params, abtRx,
-                                                                     sizeof abtRx, -1);
-                                if (res >= 0) break;
-                            }
-                            if (key_index >= num_keys) {
-                                snprintf(result, sizeof result, "nfc_initiator_transceive_bytes: %s", nfc_strerror(baton->pnd));
-                                tag->SetError(result);
-                                break;
-                            }
-                        }
+    // Some drivers leave devices that are claimed out of the listing, so a device kept open
+    // by a started NFC counts as attached until its reader loses it.
+    void DeviceMonitor::List() {
+        nfc_connstring connstrings[MAX_DEVICE_COUNT];
+        size_t i, n = nfc_list_devices(context, connstrings, MAX_DEVICE_COUNT);
 
-                        command[0] = MC_READ;
-                        command[1] = cnt;
-                        res = nfc_initiator_transceive_bytes(baton->pnd, command, 2, dp, 16, -1);
-                        if (res >= 0) continue;
+        std::set<std::string> held, now;
+        HeldDevices(held);
+        std::vector<std::string> current(connstrings, connstrings + n);
+        for (i = 0; i < n; i++) now.insert(current[i]);
+        for (std::set<std::string>::iterator it = held.begin(); it != held.end(); it++) {
+            if (now.insert(*it).second) current.push_back(*it);
+        }
+        if (current == attached) return;
 
-                        if (res != NFC_ERFTRANS) {
-                            snprintf(result, sizeof result, "nfc_initiator_transceive_bytes: %s", nfc_strerror(baton->pnd));
-                            tag->SetError(result);
-                        }
-                        break;
-                    }
-                    if (cnt >= 0) break;
+        std::set<std::string> before(attached.begin(), attached.end());
+        device_cache.Refresh(current, held);
 
-                    tag->SetData(data, len);
+        uv_mutex_lock(&mutex);
+        for (i = 0; i < attached.size(); i++) {
+            if (!now.count(attached[i])) events.push_back(std::make_pair(false, attached[i]));
+        }
+        for (i = 0; i < current.size(); i++) {
+            if (!before.count(current[i])) events.push_back(std::make_pair(true, current[i]));
+        }
+        listed = current;
+        uv_mutex_unlock(&mutex);
 
-                    tag->SetOffset(16 * 4);
-                    break;
-                }
+        attached.swap(current);
+        uv_async_send(&async);
+    }
 
-                case 0x44:
-                {
-                    tag->SetTag("mifare-ultralight");
+    NAUV_WORK_CB(DeviceMonitor::HandleAsync) {
+        static_cast<DeviceMonitor*>(async->data)->HandleEvents();
+    }
 
-                    if (nfc_device_set_property_bool(baton->pnd, NP_EASY_FRAMING, true) < 0) {
-                        snprintf(result, sizeof result, "nfc_device_set_property_bool easyFraming=false: %s",
-                                 nfc_strerror(baton->pnd));
-                        tag->SetError(result);
-                        break;
-                    }
+    void DeviceMonitor::HandleClose(uv_handle_t *handle) {
+        DeviceMonitor *monitor = static_cast<DeviceMonitor*>(handle->data);
+        monitor->closing = false;
+        monitor->Unref();
+    }
 
-                    int cnt, len, res;
-                    uint8_t command[2], data[16 * 12], *dp;
-                    for (n = 0, cc = 0x0f, dp = data, cnt = sizeof data, len = 0;
-                             n < cc;
-                             n += 4, dp += res, cnt -= res, len += res) {
-                        command[0] = MC_READ;
-                        command[1] = n;
-                        res = nfc_initiator_transceive_bytes(baton->pnd, command, 2, dp, cnt, -1);
-                        if (res >= 0) continue;
-
-                        if (res != NFC_ERFTRANS) {
-                            snprintf(result, sizeof result, "nfc_initiator_transceive_bytes: %s", nfc_strerror(baton->pnd));
-                            tag->SetError(result);
-                        }
-                        break;
-                    }
-                    if (n < cc) break;
+    void DeviceMonitor::HandleEvents() {
+        Nan::HandleScope scope;
 
-                    tag->SetData(data, len);
+        std::deque<std::pair<bool, std::string> > batch;
+        uv_mutex_lock(&mutex);
+        batch.swap(events);
+        bool finished = done;
+        uv_mutex_unlock(&mutex);
 
-                    tag->SetOffset(16);
-                    break;
-                }
+        while(!batch.empty()) {
+            Local<Object> device = Nan::New<Object>();
+            Nan::Set(device, Nan::New("deviceID").ToLocalChecked(), Nan::New(batch.front().second).ToLocalChecked());
 
-                default:
-                    break;
-            }
+            Local<Value> argv[2];
+            argv[0] = Nan::New(batch.front().first ? "attached" : "detached").ToLocalChecked();
+            argv[1] = device;
+            batch.pop_front();
+
+            async_resource.runInAsyncScope(handle(), "emit", 2, argv);
         }
 
-        void HandleProgressCallback(const char *_tag, size_t size) {
-            Nan::HandleScope scope;
+        if(finished && started) {
+            uv_thread_join(&thread);
+            started = false;
+            ReleaseContext();
 
-            Local<Object> object = Nan::New<Object>();
-            tag->AddToNodeObject(object);
-            delete tag;
-            tag = NULL;
+            uv_mutex_lock(&running_mutex);
+            monitors.erase(this);
+            uv_mutex_unlock(&running_mutex);
 
-            Local<Value> argv[2];
-            argv[0] = Nan::New("read").ToLocalChecked();
-            argv[1] = object;
-            
-            Local<Object> self = GetFromPersistent("self").As<Object>();
-            Nan::MakeCallback(self, "emit", 2, argv);
+            closing = true;
+            uv_close((uv_handle_t*)&async, HandleClose);
+
+            Local<Value> argv = Nan::New("stopped").ToLocalChecked();
+            async_resource.runInAsyncScope(handle(), "emit", 1, &argv);
         }
+    }
 
-      private:
-        NFC *baton;
-        NFCCard *tag;
-    };
+    void DeviceMonitor::stop() {
+        uv_mutex_lock(&mutex);
+        run = false;
+        uv_cond_signal(&cond);
+        uv_mutex_unlock(&mutex);
+    }
 
+    // node (or the worker thread whose loop is arg) is exiting, the monitor threads must be gone
+    // before the context is.
+    void DeviceMonitor::AtExit(void *arg) {
+        std::set<DeviceMonitor*> all;
 
-    NAN_METHOD(NFC::New) {
+        uv_mutex_lock(&running_mutex);
+        for (std::set<DeviceMonitor*>::iterator it = monitors.begin(); it != monitors.end();) {
+            if (!arg || (*it)->async.loop == arg) {
+                all.insert(*it);
+                monitors.erase(it++);
+            } else {
+                it++;
+            }
+        }
+        uv_mutex_unlock(&running_mutex);
+
+        std::set<DeviceMonitor*>::iterator it;
+        for (it = all.begin(); it != all.end(); it++) (*it)->stop();
+        for (it = all.begin(); it != all.end(); it++) {
+            uv_thread_join(&(*it)->thread);
+            (*it)->started = false;
+            ReleaseContext();
+        }
+    }
+
+    NAN_METHOD(DeviceMonitor::New) {
         Nan::HandleScope scope;
         assert(info.IsConstructCall());
-        NFC* self = new NFC();
+        DeviceMonitor* self = new DeviceMonitor();
         self->Wrap(info.This());
         info.GetReturnValue().Set(info.This());
     }
 
-    NAN_METHOD(NFC::Stop) {
+    // start([options]), options.interval is the time between listings in ms (default 250).
+    NAN_METHOD(DeviceMonitor::Start) {
         Nan::HandleScope scope;
-        NFC* nfc = ObjectWrap::Unwrap<NFC>(info.This());
-        nfc->stop();
+        DeviceMonitor* monitor = ObjectWrap::Unwrap<DeviceMonitor>(info.This());
+        if (monitor->started || monitor->closing) {
+            return Nan::ThrowError(monitor->started ? "device monitor already started" : "device monitor is still stopping");
+        }
+
+        uint32_t interval = 250;
+        if (info.Length() > 0 && !info[0]->IsUndefined()) {
+            if (!info[0]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            Local<Value> value = Nan::Get(info[0].As<Object>(), Nan::New("interval").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() < 10 || Nan::To<uint32_t>(value).FromJust() > 60000) {
+                    return Nan::ThrowError("interval option must be between 10 and 60000 ms");
+                }
+                interval = Nan::To<uint32_t>(value).FromJust();
+            }
+        }
+
+        monitor->context = AcquireContext();
+        if (monitor->context == NULL) return Nan::ThrowError("unable to init libfnc (malloc).");
+
+        monitor->interval = interval;
+        monitor->attached.clear();
+        monitor->listed.clear();
+        monitor->events.clear();
+        monitor->run = true;
+        monitor->done = false;
+        uv_async_init(Nan::GetCurrentEventLoop(), &monitor->async, HandleAsync);
+        monitor->async.data = monitor;
+        monitor->Ref(); //kept alive while the thread runs, HandleClose lets go
+
+        if (uv_thread_create(&monitor->thread, Run, monitor) != 0) {
+            ReleaseContext();
+            monitor->closing = true;
+            uv_close((uv_handle_t*)&monitor->async, HandleClose);
+            return Nan::ThrowError("unable to start device monitor thread");
+        }
+        monitor->started = true;
+
+        uv_mutex_lock(&running_mutex);
+        monitors.insert(monitor);
+        uv_mutex_unlock(&running_mutex);
+
         info.GetReturnValue().Set(info.This());
     }
 
-    NAN_METHOD(NFC::Start) {
+    NAN_METHOD(DeviceMonitor::Stop) {
         Nan::HandleScope scope;
+        DeviceMonitor* monitor = ObjectWrap::Unwrap<DeviceMonitor>(info.This());
+        monitor->stop();
+        info.GetReturnValue().Set(monitor->started); //"stopped" will follow
+    }
 
-        nfc_context *context;
-        nfc_init(&context);
-        if (context == NULL) return Nan::ThrowError("unable to init libfnc (malloc).");
-
-        nfc_device *pnd;
-        if (info.Length() > 0) {
-            if (!info[0]->IsString()) {
-                nfc_exit(context);
-                return Nan::ThrowError("deviceID parameter is not a string");
-            }
-            nfc_connstring connstring;
-            String::Utf8Value device(info[0]->ToString());
-            snprintf(connstring, sizeof connstring, "%s", *device);
+    NAN_METHOD(DeviceMonitor::Devices) {
+        Nan::HandleScope scope;
+        DeviceMonitor* monitor = ObjectWrap::Unwrap<DeviceMonitor>(info.This());
 
-            pnd = nfc_open(context, connstring);
-        } else {
-            pnd = nfc_open(context, NULL);
+        Local<Array> devices = Nan::New<Array>();
+        uv_mutex_lock(&monitor->mutex);
+        for (size_t i = 0; i < monitor->listed.size(); i++) {
+            Nan::Set(devices, i, Nan::New(monitor->listed[i]).ToLocalChecked());
         }
-        if (pnd == NULL) {
-            nfc_exit(context);
-            return Nan::ThrowError("unable open NFC device");
+        uv_mutex_unlock(&monitor->mutex);
+        info.GetReturnValue().Set(devices);
+    }
+
+    // scan([options], [callback]), without a callback the devices are probed synchronously.
+    NAN_METHOD(Scan) {
+        Nan::HandleScope scope;
+
+        int argc = info.Length();
+        bool refresh = false;
+        Local<Function> callback;
+        if (argc > 0 && info[argc - 1]->IsFunction()) callback = info[--argc].As<Function>();
+        if (argc > 0 && !info[0]->IsUndefined()) {
+            if (!info[0]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            Local<Value> value = Nan::Get(info[0].As<Object>(), Nan::New("refresh").ToLocalChecked()).ToLocalChecked();
+            refresh = Nan::To<bool>(value).FromJust();
         }
 
-        char result[BUFSIZ];
-        if (nfc_initiator_init(pnd) < 0) {
-            snprintf(result, sizeof result, "nfc_initiator_init: %s", nfc_strerror(pnd));
-            nfc_close(pnd);
-            nfc_exit(context);
-            return Nan::ThrowError(result);
+        ScanJob *job = new ScanJob(refresh);
+        if (!callback.IsEmpty()) {
+            if (job->Start(callback) != 0) return Nan::ThrowError("unable to start scan thread");
+            return;
         }
 
-        NFC *baton = ObjectWrap::Unwrap<NFC>(info.This());
-        baton->context = context;
-        baton->pnd = pnd;
+        job->Execute();
+        const char *err = job->Error();
+        if (err) {
+            delete job;
+            return Nan::ThrowError(err);
+        }
+        info.GetReturnValue().Set(job->Result());
+        delete job;
+    }
 
-        NFCReadWorker* readWorker = new NFCReadWorker(baton, info.This());
-        Nan::AsyncQueueWorker(readWorker);
+    // parse(buffer): TLVs and NDEF records, values are slices of buffer.
+    NAN_METHOD(Parse) {
+        Nan::HandleScope scope;
 
-        Local<Object> object = Nan::New<Object>();
-        object->Set(Nan::New("deviceID").ToLocalChecked(), Nan::New(nfc_device_get_connstring(baton->pnd)).ToLocalChecked());
-        object->Set(Nan::New("name").ToLocalChecked(), Nan::New(nfc_device_get_name(baton->pnd)).ToLocalChecked());
+        if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) return Nan::ThrowError("data parameter is not a Buffer");
 
-        info.GetReturnValue().Set(object);
+        Local<Object> buffer = Nan::To<Object>(info[0]).ToLocalChecked();
+        NdefParser parser;
+        parser.Parse((const uint8_t *) node::Buffer::Data(buffer), node::Buffer::Length(buffer));
+        info.GetReturnValue().Set(NdefToNode(parser, buffer, 0));
     }
 
-    NAN_METHOD(Scan) {
-        Nan::HandleScope scope;
+    static Local<Object> JournalEntryToNode(const JournalEntry &entry) {
+        Local<Object> object = Nan::New<Object>();
+        char uid[3 * 10], *bp = uid;
 
-        nfc_context *context;
-        nfc_init(&context);
-        if (context == NULL) return Nan::ThrowError("unable to init libfnc (malloc).");
+        uid[0] = '\0';
+        for (size_t n = 0; n < entry.uid.size() && n < 10; n++, bp += strlen(bp)) {
+            snprintf(bp, sizeof uid - (bp - uid), "%s%02x", n ? ":" : "", entry.uid[n]);
+        }
 
-        Local<Object> object = Nan::New<Object>();
+        Nan::Set(object, Nan::New("position").ToLocalChecked(), Nan::New<Number>(entry.position));
+        Nan::Set(object, Nan::New("time").ToLocalChecked(), Nan::New<Number>(entry.time_us / 1000.0));
+        Nan::Set(object, Nan::New("deviceID").ToLocalChecked(), Nan::New(entry.device_id).ToLocalChecked());
+        Nan::Set(object, Nan::New("uid").ToLocalChecked(), Nan::New(uid).ToLocalChecked());
+        if (entry.type) Nan::Set(object, Nan::New("type").ToLocalChecked(), Nan::New<Int32>(entry.type));
+        if (!entry.tag.empty()) Nan::Set(object, Nan::New("tag").ToLocalChecked(), Nan::New(entry.tag).ToLocalChecked());
+        if (entry.atqa[0] || entry.atqa[1] || entry.sak) {
+            Nan::Set(object, Nan::New("atqa").ToLocalChecked(), Nan::New<Int32>(entry.atqa[0] << 8 | entry.atqa[1]));
+            Nan::Set(object, Nan::New("sak").ToLocalChecked(), Nan::New<Int32>(entry.sak));
+        }
+        if (!entry.error.empty()) Nan::Set(object, Nan::New("error").ToLocalChecked(), Nan::New(entry.error).ToLocalChecked());
+        if (!entry.data.empty()) {
+            Nan::Set(object, Nan::New("data").ToLocalChecked(), Nan::CopyBuffer((const char *) &entry.data[0], entry.data.size()).ToLocalChecked());
+            Nan::Set(object, Nan::New("offset").ToLocalChecked(), Nan::New<Int32>((int32_t) entry.offset));
+        }
+        if (entry.auth_attempts >= 0) {
+            Local<Object> auth = Nan::New<Object>();
+            Nan::Set(auth, Nan::New("attempts").ToLocalChecked(), Nan::New<Int32>(entry.auth_attempts));
+            Nan::Set(object, Nan::New("auth").ToLocalChecked(), auth);
+        }
 
-        nfc_connstring connstrings[MAX_DEVICE_COUNT];
-        size_t i, n = nfc_list_devices(context, connstrings, MAX_DEVICE_COUNT);
-        for (i = 0; i < n; i++) {
-            Local<Object> entry = Nan::New<Object>();
-            nfc_device *pnd = nfc_open(context, connstrings[i]);
-            if (pnd == NULL) continue;
+        Local<Object> timings = Nan::New<Object>();
+        Nan::Set(timings, Nan::New("read").ToLocalChecked(), Nan::New<Number>(entry.read_us));
+        if (entry.probe_us >= 0) Nan::Set(timings, Nan::New("probe").ToLocalChecked(), Nan::New<Number>(entry.probe_us));
+        Nan::Set(timings, Nan::New("frames").ToLocalChecked(), Nan::New<Int32>(entry.frames));
+        Nan::Set(object, Nan::New("timings").ToLocalChecked(), timings);
+        return object;
+    }
 
-            entry->Set(Nan::New("name").ToLocalChecked(), Nan::New(nfc_device_get_name(pnd)).ToLocalChecked());
+    // readJournal(dir, [{ from: position, since: ms or Date, limit }]) -> { records: [ ... ], next: position }
+    NAN_METHOD(ReadJournal) {
+        Nan::HandleScope scope;
 
-            char *info;
-            if (nfc_device_get_information_about(pnd, &info) >= 0) {
-                entry->Set(Nan::New("info").ToLocalChecked(), Nan::New(info).ToLocalChecked());
-                nfc_free(info);
-            } else {
-                entry->Set(Nan::New("info").ToLocalChecked(), Nan::New("").ToLocalChecked());
+        if (info.Length() < 1 || !info[0]->IsString()) return Nan::ThrowError("dir parameter is not a string");
+        uint64_t from = 0, since_us = 0;
+        size_t limit = 1000;
+        if (info.Length() > 1 && !info[1]->IsUndefined()) {
+            if (!info[1]->IsObject()) return Nan::ThrowError("options parameter is not an object");
+            Local<Object> options = info[1].As<Object>();
+
+            Local<Value> value = Nan::Get(options, Nan::New("from").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsNumber() || Nan::To<double>(value).FromJust() < 0) return Nan::ThrowError("from option is not a journal position");
+                from = (uint64_t) Nan::To<double>(value).FromJust();
+            }
+
+            value = Nan::Get(options, Nan::New("since").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsNumber() && !value->IsDate()) return Nan::ThrowError("since option is not a Date or milliseconds");
+                double ms = Nan::To<double>(value).FromJust();
+                since_us = ms > 0 ? (uint64_t) (ms * 1000) : 0;
             }
-            object->Set(Nan::New(nfc_device_get_connstring(pnd)).ToLocalChecked(), entry);
 
-            nfc_close(pnd);
+            value = Nan::Get(options, Nan::New("limit").ToLocalChecked()).ToLocalChecked();
+            if (!value->IsUndefined()) {
+                if (!value->IsUint32() || Nan::To<uint32_t>(value).FromJust() == 0) return Nan::ThrowError("limit option is not a positive integer");
+                limit = Nan::To<uint32_t>(value).FromJust();
+            }
         }
 
-        nfc_exit(context);
+        Nan::Utf8String dir(info[0]);
+        std::vector<JournalEntry> entries;
+        uint64_t next;
+        std::string error;
+        if (!Journal::Read(*dir, from, since_us, limit, entries, &next, error)) return Nan::ThrowError(error.c_str());
 
+        Local<Array> records = Nan::New<Array>(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) Nan::Set(records, i, JournalEntryToNode(entries[i]));
+
+        Local<Object> object = Nan::New<Object>();
+        Nan::Set(object, Nan::New("records").ToLocalChecked(), records);
+        Nan::Set(object, Nan::New("next").ToLocalChecked(), Nan::New<Number>(next));
         info.GetReturnValue().Set(object);
     }
 
+    NAN_METHOD(ExportKeyCache) {
+        Nan::HandleScope scope;
+
+        std::vector<uint8_t> snapshot;
+        key_cache.Export(snapshot);
+        info.GetReturnValue().Set(Nan::CopyBuffer((const char *) &snapshot[0], snapshot.size()).ToLocalChecked());
+    }
+
+    NAN_METHOD(ImportKeyCache) {
+        Nan::HandleScope scope;
+
+        if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) return Nan::ThrowError("snapshot parameter is not a Buffer");
+        if (!key_cache.Import((const uint8_t *) node::Buffer::Data(info[0]), node::Buffer::Length(info[0]))) {
+            return Nan::ThrowError("invalid key cache snapshot");
+        }
+        info.GetReturnValue().Set(Nan::New<Number>(key_cache.Size()));
+    }
+
     NAN_METHOD(Version) {
         Nan::HandleScope       scope;
 
-        nfc_context *context;
-        nfc_init(&context);
-        if (context == NULL) return Nan::ThrowError("unable to init libnfc (malloc).");
-
         Local<Object> object = Nan::New<Object>();
-        object->Set(Nan::New("name").ToLocalChecked(), Nan::New("libnfc").ToLocalChecked());
-        object->Set(Nan::New("version").ToLocalChecked(), Nan::New(nfc_version()).ToLocalChecked());
-
-        nfc_exit(context);
+        Nan::Set(object, Nan::New("name").ToLocalChecked(), Nan::New("libnfc").ToLocalChecked());
+        Nan::Set(object, Nan::New("version").ToLocalChecked(), Nan::New(nfc_version()).ToLocalChecked());
 
         info.GetReturnValue().Set(object);
     }
@@ -485,11 +3725,42 @@ namespace {
 
         SetPrototypeMethod(tpl, "start", NFC::Start);
         SetPrototypeMethod(tpl, "stop", NFC::Stop);
+        SetPrototypeMethod(tpl, "queueStats", NFC::QueueStats);
+        SetPrototypeMethod(tpl, "stats", NFC::Stats);
+        SetPrototypeMethod(tpl, "readBlocks", NFC::ReadBlocks);
+        SetPrototypeMethod(tpl, "write", NFC::Write);
+        SetPrototypeMethod(tpl, "increment", NFC::Increment);
+        SetPrototypeMethod(tpl, "decrement", NFC::Decrement);
+        SetPrototypeMethod(tpl, "restore", NFC::Restore);
+        SetPrototypeMethod(tpl, "transceive", NFC::Transceive);
+        SetPrototypeMethod(tpl, "pause", NFC::Pause);
+        SetPrototypeMethod(tpl, "resume", NFC::Resume);
+        SetPrototypeMethod(tpl, "detach", NFC::Detach);
+
+        Local<v8::FunctionTemplate> monitor = Nan::New<v8::FunctionTemplate>(DeviceMonitor::New);
+        monitor->SetClassName(Nan::New("DeviceMonitor").ToLocalChecked());
+        monitor->InstanceTemplate()->SetInternalFieldCount(1);
+
+        SetPrototypeMethod(monitor, "start", DeviceMonitor::Start);
+        SetPrototypeMethod(monitor, "stop", DeviceMonitor::Stop);
+        SetPrototypeMethod(monitor, "devices", DeviceMonitor::Devices);
 
         Nan::Export(target, "version", Version);
         Nan::Export(target, "scan", Scan);
-        Nan::Set(target, Nan::New("NFC").ToLocalChecked(), tpl->GetFunction());
+        Nan::Export(target, "parse", Parse);
+        Nan::Export(target, "exportKeyCache", ExportKeyCache);
+        Nan::Export(target, "importKeyCache", ImportKeyCache);
+        Nan::Export(target, "readJournal", ReadJournal);
+        Nan::Set(target, Nan::New("NFC").ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
+        Nan::Set(target, Nan::New("DeviceMonitor").ToLocalChecked(), Nan::GetFunction(monitor).ToLocalChecked());
+
+#if NFC_ENV_CLEANUP_HOOKS
+        // Loaded once per thread, each thread's readers and monitors go when its environment does.
+        uv_once(&running_once, InitRunning);
+        node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), NFC::AtExit, Nan::GetCurrentEventLoop());
+        node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), DeviceMonitor::AtExit, Nan::GetCurrentEventLoop());
+#endif
     };
 }
 
-NODE_MODULE(nfc, init)
+NAN_MODULE_WORKER_ENABLED(nfc, init)
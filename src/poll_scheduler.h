@@ -0,0 +1,124 @@
+#ifndef _NFC_POLL_SCHEDULER_H_
+#  define _NFC_POLL_SCHEDULER_H_
+
+#  include <stdint.h>
+#  include <algorithm>
+#  include <atomic>
+#  include <map>
+#  include <uv.h>
+
+typedef enum {
+  POLL_DEVICE,      // the device polls on its own until a target shows up
+  POLL_FIXED,       // the host probes every pollInterval
+  POLL_BACKOFF      // the host probes, the interval doubling while idle
+} poll_strategy;
+
+/**
+ * A reader's place in the scheduler. run and paused are the reader's own flags,
+ * a slot is never granted to a reader that was stopped or paused meanwhile.
+ */
+struct PollSlot {
+    PollSlot(const std::atomic<bool> &run, const std::atomic<bool> &paused, uint64_t spacing)
+        : run(run), paused(paused), spacing(spacing), queued(false) {
+        uv_cond_init(&cond);
+    }
+
+    ~PollSlot() {
+        uv_cond_destroy(&cond);
+    }
+
+    bool Runnable() const {
+        return run && !paused;
+    }
+
+    const std::atomic<bool>     &run;
+    const std::atomic<bool>     &paused;
+    uint64_t                    spacing;    // ns since the previous grant to any reader
+    uv_cond_t                   cond;
+    bool                        queued;     // under the scheduler lock
+    std::multimap<uint64_t, PollSlot*>::iterator position;
+};
+
+/**
+ * Hands out poll slots to the readers of the process from one thread, so idle readers
+ * probe on their own schedule but never at the same time: a slot is granted at its due
+ * time at the earliest, and at least its spacing after the previous one. The thread
+ * is started with the first slot asked for and lives as long as the process.
+ */
+class PollScheduler {
+  public:
+    PollScheduler() : started(false), last(0) {
+        uv_mutex_init(&mutex);
+        uv_cond_init(&wake);
+    }
+
+    // Reader thread, blocks until the slot is granted. due is in uv_hrtime() units.
+    // Returns false when the reader was stopped or paused while waiting.
+    bool Wait(PollSlot &slot, uint64_t due) {
+        uv_mutex_lock(&mutex);
+        if (!started) started = uv_thread_create(&thread, Run, this) == 0;
+        if (!started || !slot.Runnable()) {
+            uv_mutex_unlock(&mutex);
+            return !started && slot.Runnable();     //unpaced without a scheduler thread
+        }
+
+        slot.position = queue.insert(std::make_pair(due, &slot));
+        slot.queued = true;
+        uv_cond_signal(&wake);
+        while (slot.queued && slot.Runnable()) uv_cond_wait(&slot.cond, &mutex);
+
+        bool granted = !slot.queued;
+        if (slot.queued) {
+            queue.erase(slot.position);
+            slot.queued = false;
+            uv_cond_signal(&wake);
+        }
+        uv_mutex_unlock(&mutex);
+        return granted;
+    }
+
+    // Any thread, after the slot's run or paused flag changed.
+    void Interrupt(PollSlot &slot) {
+        uv_mutex_lock(&mutex);
+        uv_cond_signal(&slot.cond);
+        uv_mutex_unlock(&mutex);
+    }
+
+  private:
+    static void Run(void *arg) {
+        PollScheduler *scheduler = static_cast<PollScheduler*>(arg);
+        uv_mutex_lock(&scheduler->mutex);
+        for (;;) scheduler->Grant();
+    }
+
+    // Under the lock, grants the earliest slot once it is due or waits for it.
+    void Grant() {
+        if (queue.empty()) {
+            uv_cond_wait(&wake, &mutex);
+            return;
+        }
+
+        std::multimap<uint64_t, PollSlot*>::iterator next = queue.begin();
+        PollSlot *slot = next->second;
+        uint64_t due = std::max(next->first, last + slot->spacing);
+        uint64_t now = uv_hrtime();
+        if (now < due) {
+            uv_cond_timedwait(&wake, &mutex, due - now);   //woken early when the queue changes
+            return;
+        }
+
+        queue.erase(next);
+        slot->queued = false;
+        last = now;
+        uv_cond_signal(&slot->cond);
+    }
+
+    uv_mutex_t                          mutex;
+    uv_cond_t                           wake;
+    uv_thread_t                         thread;
+    bool                                started;
+    uint64_t                            last;       // uv_hrtime() of the previous grant
+    std::multimap<uint64_t, PollSlot*>  queue;      // waiting slots by due time
+};
+
+#endif // _NFC_POLL_SCHEDULER_H_
@@ -0,0 +1,138 @@
+#ifndef _NFC_POOL_H_
+#  define _NFC_POOL_H_
+
+#  include <stdint.h>
+#  include <stdlib.h>
+#  include <atomic>
+#  include <vector>
+#  include <uv.h>
+
+/**
+ * Fixed size byte slabs carved out of one arena. The reader thread fills a slab
+ * with tag data and node wraps it in an external Buffer whose free callback
+ * hands it back, so steady-state reads don't touch the heap.
+ *
+ * Buffers can outlive the reader, so the pool is reference counted: the reader
+ * holds one reference and every slab handed to node holds another.
+ * When the arena runs dry slabs fall back to malloc, counted in Misses().
+ */
+class SlabPool {
+  public:
+    SlabPool(size_t slab_size, size_t count)
+        : slab_size(slab_size), count(count), refs(1), misses(0) {
+        arena = (uint8_t *) malloc(slab_size * count);
+        free_slabs.reserve(count);
+        for (size_t i = count; i > 0; i--) free_slabs.push_back(arena + (i - 1) * slab_size);
+        uv_mutex_init(&mutex);
+    }
+
+    uint8_t *Acquire() {
+        uint8_t *slab = NULL;
+        uv_mutex_lock(&mutex);
+        if (!free_slabs.empty()) {
+            slab = free_slabs.back();
+            free_slabs.pop_back();
+        }
+        uv_mutex_unlock(&mutex);
+        if (slab) return slab;
+
+        misses++;
+        return (uint8_t *) malloc(slab_size);
+    }
+
+    void Release(uint8_t *slab) {
+        if (slab < arena || slab >= arena + slab_size * count) return free(slab);
+
+        uv_mutex_lock(&mutex);
+        free_slabs.push_back(slab);
+        uv_mutex_unlock(&mutex);
+    }
+
+    void Ref() {
+        refs++;
+    }
+
+    void Unref() {
+        if (--refs == 0) delete this;
+    }
+
+    // Nan::NewBuffer free callback, hint is the pool.
+    static void FreeCallback(char *data, void *hint) {
+        SlabPool *pool = static_cast<SlabPool *>(hint);
+        pool->Release((uint8_t *) data);
+        pool->Unref();
+    }
+
+    size_t SlabSize() const { return slab_size; }
+    size_t Misses() const { return misses.load(std::memory_order_relaxed); }
+
+  private:
+    ~SlabPool() {
+        uv_mutex_destroy(&mutex);
+        ::free(arena);
+    }
+
+    size_t                  slab_size;
+    size_t                  count;
+    uint8_t                 *arena;
+    std::vector<uint8_t *>  free_slabs;
+    uv_mutex_t              mutex;
+    std::atomic<int>        refs;
+    std::atomic<size_t>     misses;
+};
+
+/**
+ * Preallocated records recycled between the reader thread (Acquire) and the
+ * JS thread (Release). Falls back to new/delete when exhausted.
+ */
+template <class T>
+class RecordPool {
+  public:
+    explicit RecordPool(size_t count) : count(count), misses(0) {
+        arena = new T[count];
+        free_records.reserve(count);
+        for (size_t i = count; i > 0; i--) free_records.push_back(arena + i - 1);
+        uv_mutex_init(&mutex);
+    }
+
+    ~RecordPool() {
+        uv_mutex_destroy(&mutex);
+        delete[] arena;
+    }
+
+    T *Acquire() {
+        T *record = NULL;
+        uv_mutex_lock(&mutex);
+        if (!free_records.empty()) {
+            record = free_records.back();
+            free_records.pop_back();
+        }
+        uv_mutex_unlock(&mutex);
+        if (record) return record;
+
+        misses++;
+        return new T();
+    }
+
+    void Release(T *record) {
+        if (record < arena || record >= arena + count) {
+            delete record;
+            return;
+        }
+
+        uv_mutex_lock(&mutex);
+        free_records.push_back(record);
+        uv_mutex_unlock(&mutex);
+    }
+
+    size_t Misses() const { return misses.load(std::memory_order_relaxed); }
+
+  private:
+    size_t              count;
+    T                   *arena;
+    std::vector<T *>    free_records;
+    uv_mutex_t          mutex;
+    std::atomic<size_t> misses;
+};
+
+#endif // _NFC_POOL_H_
@@ -0,0 +1,600 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uv.h>
+#include "mifare.h"
+#include "sim.h"
+
+#define SIM_MAX_FRAME 264
+
+static const uint8_t default_key[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static bool ParseHex(const std::string &text, uint8_t *bytes, size_t len) {
+    if (text.size() != 2 * len) return false;
+    for (size_t i = 0; i < len; i++) {
+        char pair[3] = { text[2 * i], text[2 * i + 1], '\0' }, *end;
+        bytes[i] = (uint8_t) strtoul(pair, &end, 16);
+        if (*end) return false;
+    }
+    return true;
+}
+
+static bool ParseNumber(const std::string &text, uint32_t max, uint32_t *value) {
+    char *end;
+    unsigned long number = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || *end || number > max) return false;
+    *value = (uint32_t) number;
+    return true;
+}
+
+static size_t SectorOf(size_t block) {
+    return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+static size_t TrailerOf(size_t block) {
+    return block < 128 ? (block | 0x03) : (block | 0x0f);
+}
+
+static bool DecodeValue(const uint8_t *block, int32_t *value) {
+    for (int i = 0; i < 4; i++) {
+        if (block[i] != block[8 + i] || block[i] != (uint8_t) ~block[4 + i]) return false;
+    }
+    if (block[12] != block[14] || block[13] != block[15] || block[12] != (uint8_t) ~block[13]) return false;
+    *value = (int32_t) (block[0] | block[1] << 8 | block[2] << 16 | (uint32_t) block[3] << 24);
+    return true;
+}
+
+static void EncodeValue(int32_t value, uint8_t addr, uint8_t *block) {
+    for (int i = 0; i < 4; i++) {
+        block[i] = block[8 + i] = ((uint32_t) value >> (8 * i)) & 0xff;
+        block[4 + i] = ~block[i];
+    }
+    block[12] = block[14] = addr;
+    block[13] = block[15] = ~addr;
+}
+
+SimTransport::SimTransport()
+    : family(SIM_CLASSIC), units(0), sak(0), has_version(false), stack(false), dwell_ms(0), gap_ms(500), latency_us(0),
+      error_rate(0), rng(1), epoch(uv_hrtime()), easy_framing(true), infinite_select(true), selected(-1),
+      selected_tap(0), halted(false), authed(-1), has_transfer(false), transfer_value(0), transfer_addr(0),
+      last_error(NFC_SUCCESS), aborted(false) {
+    atqa[0] = atqa[1] = 0;
+    memset(version, 0, sizeof version);
+}
+
+SimTransport *SimTransport::Open(const char *connstring) {
+    SimTransport *sim = new SimTransport();
+    std::string spec(connstring + 4), type, file, uid_hex;
+    std::vector<std::string> options;
+    uint8_t uid[7], key[6];
+    bool has_key = false;
+    uint32_t count = 1, seed;
+
+    sim->connstring = connstring;
+    for (size_t start = 0, end; start <= spec.size(); start = end + 1) {
+        end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        std::string option = spec.substr(start, end - start);
+        size_t eq = option.find('=');
+        if (start == 0 && eq == std::string::npos) type = option;
+        else if (!option.empty()) options.push_back(option);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < options.size() && ok; i++) {
+        size_t eq = options[i].find('=');
+        std::string name = options[i].substr(0, eq), value = eq == std::string::npos ? "" : options[i].substr(eq + 1);
+
+        if (name == "file") file = value;
+        else if (name == "uid") uid_hex = value;
+        else if (name == "key") ok = has_key = ParseHex(value, key, sizeof key);
+        else if (name == "cards") ok = ParseNumber(value, 4096, &count) && count > 0;
+        else if (name == "stack") ok = sim->stack = value.empty();
+        else if (name == "dwell") ok = ParseNumber(value, 3600 * 1000, &sim->dwell_ms);
+        else if (name == "gap") ok = ParseNumber(value, 3600 * 1000, &sim->gap_ms);
+        else if (name == "latency") ok = ParseNumber(value, 1000 * 1000, &sim->latency_us);
+        else if (name == "seed") {
+            ok = ParseNumber(value, 0xffffffff, &seed);
+            sim->rng = (uint64_t) seed + 1;     //xorshift needs a non-zero state
+        }
+        else if (name == "errors") {
+            char *end;
+            sim->error_rate = strtod(value.c_str(), &end);
+            ok = !value.empty() && !*end && sim->error_rate >= 0 && sim->error_rate <= 1;
+        }
+        else ok = false;
+    }
+
+    if (ok) ok = file.empty() ? sim->SetType(type) : (type.empty() && sim->Load(file));
+    if (ok && !uid_hex.empty()) ok = ParseHex(uid_hex, uid, sim->cards[0].uid_len);
+    if (!ok) {
+        delete sim;
+        return NULL;
+    }
+
+    Card card = sim->cards[0];
+    if (!uid_hex.empty()) sim->SetUid(card, uid);
+    if (has_key) sim->SetKey(card, key);
+
+    sim->cards.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        Card copy = card;
+        uint8_t next[7];
+        memcpy(next, card.uid, card.uid_len);
+        uint32_t carry = i;
+        for (size_t b = card.uid_len; b > 1 && carry; b--) {
+            carry += next[b - 1];
+            next[b - 1] = carry & 0xff;
+            carry >>= 8;
+        }
+        sim->SetUid(copy, next);
+        sim->cards.push_back(copy);
+    }
+    return sim;
+}
+
+bool SimTransport::SetType(const std::string &type) {
+    Card card;
+
+    if (type == "classic1k" || type == "classic4k") {
+        family = SIM_CLASSIC;
+        units = type == "classic1k" ? 64 : 256;
+        atqa[0] = 0x00;
+        atqa[1] = type == "classic1k" ? 0x04 : 0x02;
+        sak = type == "classic1k" ? 0x08 : 0x18;
+        name = type == "classic1k" ? "Simulated MIFARE Classic 1K" : "Simulated MIFARE Classic 4K";
+
+        static const uint8_t uid[4] = { 0x5e, 0xa1, 0x3c, 0x01 };
+        card.uid_len = 4;
+        memcpy(card.uid, uid, 4);
+    } else if (type == "ultralight" || type == "ntag213" || type == "ntag215" || type == "ntag216") {
+        family = SIM_ULTRALIGHT;
+        units = type == "ultralight" ? 16 : type == "ntag213" ? 45 : type == "ntag215" ? 135 : 231;
+        atqa[0] = 0x00;
+        atqa[1] = 0x44;
+        sak = 0x00;
+        has_version = type != "ultralight";
+        if (has_version) {
+            static const uint8_t ntag[8] = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x00, 0x03 };
+            memcpy(version, ntag, sizeof version);
+            version[6] = units == 45 ? 0x0f : units == 135 ? 0x11 : 0x13;
+        }
+        name = type == "ultralight" ? "Simulated MIFARE Ultralight" : "Simulated " + type;
+
+        static const uint8_t uid[7] = { 0x04, 0x5e, 0xa1, 0x3c, 0x52, 0x6b, 0x80 };
+        card.uid_len = 7;
+        memcpy(card.uid, uid, 7);
+    } else {
+        return false;
+    }
+
+    Format(card);
+    cards.push_back(card);
+    return true;
+}
+
+// Blank cards: transport keys on Classic, an empty NDEF message on NTAG.
+void SimTransport::Format(Card &card) {
+    if (family == SIM_CLASSIC) {
+        card.memory.assign(units * 16, 0);
+        for (size_t block = 3; block < units; block = TrailerOf(block + 1)) {
+            static const uint8_t access[4] = { 0xff, 0x07, 0x80, 0x69 };
+            uint8_t *trailer = &card.memory[16 * block];
+            memcpy(trailer, default_key, 6);
+            memcpy(trailer + 6, access, 4);
+            memcpy(trailer + 10, default_key, 6);
+        }
+    } else {
+        card.memory.assign(units * 4, 0);
+        if (has_version) {
+            static const uint8_t cc[4] = { 0xe1, 0x10, 0x00, 0x00 }, tlv[4] = { 0x03, 0x00, 0xfe, 0x00 };
+            memcpy(&card.memory[12], cc, 4);
+            card.memory[14] = units == 45 ? 0x12 : units == 135 ? 0x3e : 0x6d;  // data area size / 8
+            memcpy(&card.memory[16], tlv, 4);
+        }
+    }
+    SetUid(card, card.uid);
+}
+
+// Raw dumps as nfc-mfclassic and nfc-mfultralight write them.
+bool SimTransport::Load(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    std::vector<uint8_t> memory(4096 + 1);
+    size_t size = fread(&memory[0], 1, memory.size(), file);
+    fclose(file);
+
+    const char *type = size == 1024 ? "classic1k" : size == 4096 ? "classic4k" : size == 64 ? "ultralight"
+                     : size == 180  ? "ntag213"   : size == 540  ? "ntag215"   : size == 924 ? "ntag216" : NULL;
+    if (!type || !SetType(type)) return false;
+
+    Card &card = cards[0];
+    memory.resize(size);
+    card.memory = memory;
+    if (family == SIM_CLASSIC) {
+        memcpy(card.uid, &memory[0], 4);
+    } else {
+        memcpy(card.uid, &memory[0], 3);
+        memcpy(card.uid + 3, &memory[4], 4);
+    }
+    return true;
+}
+
+// The UID lives in block 0 / pages 0-2 together with its check bytes.
+void SimTransport::SetUid(Card &card, const uint8_t *uid) {
+    uint8_t *memory = &card.memory[0];
+
+    memmove(card.uid, uid, card.uid_len);
+    if (family == SIM_CLASSIC) {
+        memcpy(memory, card.uid, 4);
+        memory[4] = card.uid[0] ^ card.uid[1] ^ card.uid[2] ^ card.uid[3];
+        memory[5] = sak;
+        memory[6] = atqa[1];
+        memory[7] = atqa[0];
+    } else {
+        memcpy(memory, card.uid, 3);
+        memory[3] = 0x88 ^ card.uid[0] ^ card.uid[1] ^ card.uid[2];
+        memcpy(memory + 4, card.uid + 3, 4);
+        memory[8] = card.uid[3] ^ card.uid[4] ^ card.uid[5] ^ card.uid[6];
+    }
+}
+
+void SimTransport::SetKey(Card &card, const uint8_t *key) {
+    if (family != SIM_CLASSIC) return;
+    for (size_t block = 3; block < units; block = TrailerOf(block + 1)) {
+        memcpy(&card.memory[16 * block], key, 6);
+        memcpy(&card.memory[16 * block + 10], key, 6);
+    }
+}
+
+const char *SimTransport::Connstring() {
+    return connstring.c_str();
+}
+
+const char *SimTransport::Name() {
+    return name.c_str();
+}
+
+int SimTransport::InformationAbout(std::string &info) {
+    char text[512];
+    snprintf(text, sizeof text,
+             "chip: simulated\n"
+             "initator mode modulations: ISO/IEC 14443A (106 kbps)\n"
+             "cards: %u%s\n"
+             "dwell: %u ms\n"
+             "gap: %u ms\n"
+             "latency: %u us\n"
+             "errors: %g\n",
+             (unsigned) cards.size(), stack ? " (stacked)" : "", dwell_ms, gap_ms, latency_us, error_rate);
+    info = text;
+    return 0;
+}
+
+const char *SimTransport::StrError() {
+    switch (last_error) {
+        case NFC_SUCCESS:       return "Success";
+        case NFC_EINVARG:       return "Invalid argument(s)";
+        case NFC_EOVFLOW:       return "Buffer Overflow";
+        case NFC_EOPABORTED:    return "Operation Aborted";
+        case NFC_ETGRELEASED:   return "Target Released";
+        case NFC_EMFCAUTHFAIL:  return "Mifare Authentication Failed";
+        case NFC_ERFTRANS:      return "RF Transmission Error";
+        default:                return "Unknown error";
+    }
+}
+
+int SimTransport::InitiatorInit() {
+    easy_framing = true;
+    infinite_select = true;
+    selected = -1;
+    last_error = NFC_SUCCESS;
+    return 0;
+}
+
+int SimTransport::SetPropertyBool(nfc_property property, bool enable) {
+    switch (property) {
+        case NP_EASY_FRAMING:       easy_framing = enable; break;
+        case NP_INFINITE_SELECT:    infinite_select = enable; break;
+        case NP_ACTIVATE_FIELD:
+            if (enable) break;
+            selected = -1;      //cards lose power and state
+            for (size_t i = 0; i < cards.size(); i++) cards[i].asleep_tap = -1;
+            break;
+        default:                    break;
+    }
+    return 0;
+}
+
+// Taps since the reader was opened, each lasting dwell + gap ms.
+int64_t SimTransport::Tap() const {
+    if (dwell_ms == 0) return 0;
+    return (int64_t) ((uv_hrtime() - epoch) / (1000 * 1000) / (dwell_ms + gap_ms));
+}
+
+// Index of the card in the field, -1 between taps.
+int SimTransport::InField() const {
+    if (dwell_ms == 0) return 0;
+    uint64_t elapsed = (uv_hrtime() - epoch) / (1000 * 1000);
+    if (elapsed % (dwell_ms + gap_ms) >= dwell_ms) return -1;
+    return (int) (Tap() % cards.size());
+}
+
+bool SimTransport::Present(int card) const {
+    int in_field = InField();
+    return in_field >= 0 && (stack || in_field == card);
+}
+
+// Halted cards only answer a WUPA, which libnfc doesn't send; taking the card away wakes it too.
+bool SimTransport::Asleep(int card) const {
+    return cards[card].asleep_tap == Tap();
+}
+
+// The card that answers a REQA: the first one in the field that isn't halted, -1 when none.
+int SimTransport::Answering() const {
+    int card = InField();
+    if (card < 0) return -1;
+    size_t first = stack ? 0 : card, end = stack ? cards.size() : card + 1;
+    for (size_t i = first; i < end; i++) {
+        if (!Asleep((int) i)) return (int) i;
+    }
+    return -1;
+}
+
+// A card index, -1 after timeout_ms (0 waits as long as it takes), -2 when aborted.
+int SimTransport::WaitForCard(uint64_t timeout_ms) {
+    uint64_t deadline = uv_hrtime() + timeout_ms * 1000 * 1000;
+    for (;;) {
+        if (aborted.exchange(false)) return -2;
+        int card = Answering();
+        if (card >= 0) return card;
+        if (timeout_ms && uv_hrtime() >= deadline) return -1;
+        usleep(2000);
+    }
+}
+
+void SimTransport::Select(int card, nfc_target *nt) {
+    Delay();
+    selected = card;
+    selected_tap = Tap();
+    cards[card].asleep_tap = -1;
+    halted = false;
+    authed = -1;
+    has_transfer = false;
+
+    memset(nt, 0, sizeof *nt);
+    nt->nm.nmt = NMT_ISO14443A;
+    nt->nm.nbr = NBR_106;
+    memcpy(nt->nti.nai.abtAtqa, atqa, 2);
+    nt->nti.nai.btSak = sak;
+    nt->nti.nai.szUidLen = cards[card].uid_len;
+    memcpy(nt->nti.nai.abtUid, cards[card].uid, cards[card].uid_len);
+}
+
+void SimTransport::Delay() const {
+    if (latency_us) usleep(latency_us);
+}
+
+// xorshift64*, errors are reproducible for a seed.
+double SimTransport::Random() {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int SimTransport::Fail(int error) {
+    last_error = error;
+    return error;
+}
+
+// The card refuses the command and halts, only a new selection wakes it up.
+int SimTransport::Nak() {
+    halted = true;
+    authed = -1;
+    has_transfer = false;
+    return Fail(NFC_ERFTRANS);
+}
+
+int SimTransport::Reply(uint8_t *rx, size_t rx_len, const uint8_t *data, size_t len) {
+    if (len > rx_len) return Fail(NFC_EOVFLOW);
+    memcpy(rx, data, len);
+    last_error = NFC_SUCCESS;
+    return (int) len;
+}
+
+int SimTransport::PollTarget(const nfc_modulation *modulations, size_t count, uint8_t poll_count, uint8_t poll_period,
+                             nfc_target *nt) {
+    uint64_t timeout_ms = poll_count == 0xff ? 0 : (uint64_t) poll_count * count * poll_period * 150;
+    bool iso14443a = false;
+    for (size_t i = 0; i < count; i++) iso14443a = iso14443a || modulations[i].nmt == NMT_ISO14443A;
+
+    if (!iso14443a) {
+        uint64_t deadline = uv_hrtime() + timeout_ms * 1000 * 1000;
+        while (!aborted && (!timeout_ms || uv_hrtime() < deadline)) usleep(2000);
+        return aborted.exchange(false) ? Fail(NFC_EOPABORTED) : 0;
+    }
+
+    int card = WaitForCard(timeout_ms ? timeout_ms : 0);
+    if (card == -2) return Fail(NFC_EOPABORTED);
+    if (card < 0) return 0;
+
+    Select(card, nt);
+    last_error = NFC_SUCCESS;
+    return 1;
+}
+
+int SimTransport::SelectPassiveTarget(nfc_modulation nm, const uint8_t *init_data, size_t init_data_len, nfc_target *nt) {
+    if (aborted.exchange(false)) return Fail(NFC_EOPABORTED);
+    if (nm.nmt != NMT_ISO14443A) return 0;
+
+    int card = init_data ? InField() : infinite_select ? WaitForCard(0) : Answering();
+    if (card == -2) return Fail(NFC_EOPABORTED);
+    if (card < 0) return 0;
+    if (init_data) {    //selecting by UID also reaches a halted card
+        size_t i = stack ? 0 : card, end = stack ? cards.size() : card + 1;
+        while (i < end && (init_data_len != cards[i].uid_len || memcmp(init_data, cards[i].uid, init_data_len) != 0)) i++;
+        if (i == end) return 0;
+        card = (int) i;
+    }
+
+    Select(card, nt);
+    last_error = NFC_SUCCESS;
+    return 1;
+}
+
+// Like libnfc, every card listed is left halted and has to be selected again by its UID.
+// Cards that were already halted don't answer.
+int SimTransport::ListPassiveTargets(nfc_modulation nm, nfc_target *targets, size_t count) {
+    if (aborted.exchange(false)) return Fail(NFC_EOPABORTED);
+    last_error = NFC_SUCCESS;
+    if (nm.nmt != NMT_ISO14443A) return 0;
+
+    int card = InField();
+    if (card < 0) return 0;
+
+    size_t found = 0, first = stack ? 0 : card, end = stack ? cards.size() : card + 1;
+    for (size_t i = first; i < end && found < count; i++) {
+        if (Asleep((int) i)) continue;
+        Select((int) i, &targets[found++]);
+        cards[i].asleep_tap = Tap();
+    }
+    selected = -1;
+    return (int) found;
+}
+
+// HLTA, the card stays quiet until it is woken up.
+int SimTransport::DeselectTarget() {
+    Delay();
+    if (selected >= 0 && Present(selected)) cards[selected].asleep_tap = Tap();
+    selected = -1;
+    last_error = NFC_SUCCESS;
+    return NFC_SUCCESS;
+}
+
+int SimTransport::TargetIsPresent(const nfc_target *nt) {
+    if (selected >= 0 && (!Present(selected) || Tap() != selected_tap)) selected = -1;
+    if (selected < 0 || nt->nti.nai.szUidLen != cards[selected].uid_len ||
+        memcmp(nt->nti.nai.abtUid, cards[selected].uid, cards[selected].uid_len) != 0) {
+        return Fail(NFC_ETGRELEASED);
+    }
+    last_error = NFC_SUCCESS;
+    return NFC_SUCCESS;
+}
+
+int SimTransport::TransceiveBytes(const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len, int timeout) {
+    if (aborted.exchange(false)) return Fail(NFC_EOPABORTED);
+    // timeout is in ms as libnfc takes it, 0 waits forever and negative is the driver default.
+    if (timeout > 0 && latency_us > (uint64_t) timeout * 1000) {
+        usleep((useconds_t) timeout * 1000);
+        return Fail(NFC_ETIMEOUT);
+    }
+    Delay();
+
+    if (selected >= 0 && (!Present(selected) || Tap() != selected_tap)) selected = -1;
+    if (selected < 0 || halted || tx_len < 1) return Fail(NFC_ERFTRANS);
+    if (error_rate > 0 && Random() < error_rate) return Nak();
+    if (!easy_framing) return Nak();    //RATS and other ISO14443-4 frames go unanswered
+
+    Card &card = cards[selected];
+    return family == SIM_CLASSIC ? ClassicCommand(card, tx, tx_len, rx, rx_len) : UltralightCommand(card, tx, tx_len, rx, rx_len);
+}
+
+int SimTransport::ClassicCommand(Card &card, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len) {
+    if (tx_len < 2 || tx[1] >= units) return Nak();
+
+    size_t block = tx[1], sector = SectorOf(block);
+    uint8_t *memory = &card.memory[16 * block], response[16];
+    int32_t value;
+
+    switch (tx[0]) {
+        case MC_AUTH_A:
+        case MC_AUTH_B:
+        {
+            if (tx_len < 2 + sizeof(struct mifare_param_auth)) return Nak();
+            const uint8_t *trailer = &card.memory[16 * TrailerOf(block)];
+            if (memcmp(tx + 2, tx[0] == MC_AUTH_A ? trailer : trailer + 10, 6) != 0) {
+                Nak();
+                return Fail(NFC_EMFCAUTHFAIL);
+            }
+            authed = (int) sector;
+            has_transfer = false;
+            return Reply(rx, rx_len, response, 0);
+        }
+
+        case MC_READ:
+            if (authed != (int) sector) return Nak();
+            memcpy(response, memory, 16);
+            if (block == TrailerOf(block)) memset(response, 0, 6);  //key A never reads back
+            return Reply(rx, rx_len, response, 16);
+
+        case MC_WRITE:
+            if (authed != (int) sector || tx_len < 18 || block == 0) return Nak();
+            memcpy(memory, tx + 2, 16);
+            return Reply(rx, rx_len, response, 0);
+
+        case MC_INCREMENT:
+        case MC_DECREMENT:
+        case MC_STORE:
+        {
+            if (authed != (int) sector || tx_len < 6 || !DecodeValue(memory, &value)) return Nak();
+            int32_t operand = (int32_t) (tx[2] | tx[3] << 8 | tx[4] << 16 | (uint32_t) tx[5] << 24);
+            transfer_value = tx[0] == MC_INCREMENT ? value + operand : tx[0] == MC_DECREMENT ? value - operand : value;
+            transfer_addr = memory[12];
+            has_transfer = true;
+            return Reply(rx, rx_len, response, 0);
+        }
+
+        case MC_TRANSFER:
+            if (authed != (int) sector || !has_transfer || block == 0 || block == TrailerOf(block)) return Nak();
+            EncodeValue(transfer_value, transfer_addr, memory);
+            has_transfer = false;
+            return Reply(rx, rx_len, response, 0);
+
+        default:
+            return Nak();
+    }
+}
+
+int SimTransport::UltralightCommand(Card &card, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len) {
+    uint8_t response[SIM_MAX_FRAME];
+    size_t page;
+
+    switch (tx[0]) {
+        case 0x30:  // READ, four pages rolling over at the end
+            if (tx_len < 2 || tx[1] >= units) return Nak();
+            for (size_t i = 0; i < 4; i++) memcpy(response + 4 * i, &card.memory[4 * ((tx[1] + i) % units)], 4);
+            return Reply(rx, rx_len, response, 16);
+
+        case 0x3a:  // FAST_READ
+            if (!has_version || tx_len < 3 || tx[1] > tx[2] || tx[2] >= units) return Nak();
+            if ((size_t) (tx[2] - tx[1] + 1) * 4 > sizeof response) return Nak();
+            return Reply(rx, rx_len, &card.memory[4 * tx[1]], (tx[2] - tx[1] + 1) * 4);
+
+        case 0x60:  // GET_VERSION
+            if (!has_version) return Nak();
+            return Reply(rx, rx_len, version, sizeof version);
+
+        case 0xa2:  // WRITE, lock bytes and the capability container are one-time programmable
+            if (tx_len < 6 || tx[1] < 2 || tx[1] >= units) return Nak();
+            page = tx[1];
+            if (page == 2) {
+                card.memory[10] |= tx[4];
+                card.memory[11] |= tx[5];
+            } else if (page == 3) {
+                for (size_t i = 0; i < 4; i++) card.memory[12 + i] |= tx[2 + i];
+            } else {
+                memcpy(&card.memory[4 * page], tx + 2, 4);
+            }
+            return Reply(rx, rx_len, response, 0);
+
+        default:
+            return Nak();
+    }
+}
+
+int SimTransport::AbortCommand() {
+    aborted = true;
+    return 0;
+}
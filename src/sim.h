@@ -0,0 +1,121 @@
+#ifndef _NFC_SIM_H_
+#  define _NFC_SIM_H_
+
+#  include <stdint.h>
+#  include <atomic>
+#  include <string>
+#  include <vector>
+#  include "transport.h"
+
+/**
+ * A reader with simulated cards, opened with connstrings like
+ *
+ *   sim:classic1k, sim:classic4k, sim:ultralight, sim:ntag213, sim:ntag215, sim:ntag216
+ *   sim:file=card.mfd              card type from the dump size (1024, 4096, 64, 180, 540 or 924 bytes)
+ *
+ * followed by comma separated options:
+ *
+ *   uid=hex       UID of the first card (4 bytes Classic, 7 bytes Ultralight/NTAG)
+ *   cards=n       n cards with consecutive UIDs, a different one on every tap (default 1)
+ *   stack         all cards are on the reader at once, polling finds the first, listing finds them all
+ *   key=hex       key A and B of every Classic sector (default ffffffffffff, dumps keep theirs)
+ *   dwell=ms      time a card stays on the reader, 0 leaves it there (default 0)
+ *   gap=ms        time between taps (default 500)
+ *   latency=us    added to every frame, a frame with a shorter timeout times out (default 0)
+ *   errors=p      probability that a frame is lost to an RF error (default 0)
+ *   seed=n        for errors (default 1)
+ *
+ * The cards answer like MIFARE Classic and Ultralight/NTAG behind a PN53x with easy framing:
+ * Classic authenticates against the keys in its trailers and halts on a wrong key or refused
+ * command, value blocks work, NTAG answers GET_VERSION and FAST_READ. Listed and deselected
+ * cards are halted until the field is switched off or they are selected by UID. Writes change
+ * the simulated cards, never the dump file.
+ */
+class SimTransport : public Transport {
+  public:
+    // NULL when the connstring doesn't describe a card.
+    static SimTransport *Open(const char *connstring);
+
+    const char *Connstring();
+    const char *Name();
+    int InformationAbout(std::string &info);
+    const char *StrError();
+
+    int InitiatorInit();
+    int SetPropertyBool(nfc_property property, bool enable);
+    int PollTarget(const nfc_modulation *modulations, size_t count, uint8_t poll_count, uint8_t poll_period, nfc_target *nt);
+    int SelectPassiveTarget(nfc_modulation nm, const uint8_t *init_data, size_t init_data_len, nfc_target *nt);
+    int ListPassiveTargets(nfc_modulation nm, nfc_target *targets, size_t count);
+    int DeselectTarget();
+    int TargetIsPresent(const nfc_target *nt);
+    int TransceiveBytes(const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len, int timeout);
+    int AbortCommand();
+
+  private:
+    enum Family { SIM_CLASSIC, SIM_ULTRALIGHT };
+
+    struct Card {
+        Card() : uid_len(0), asleep_tap(-1) {}
+
+        std::vector<uint8_t> memory;
+        uint8_t              uid[7];
+        size_t               uid_len;
+        int64_t              asleep_tap;     // tap during which it was halted, -1 while it answers REQA
+    };
+
+    SimTransport();
+
+    bool SetType(const std::string &type);
+    bool Load(const std::string &path);
+    void Format(Card &card);
+    void SetUid(Card &card, const uint8_t *uid);
+    void SetKey(Card &card, const uint8_t *key);
+
+    int64_t Tap() const;
+    int InField() const;
+    bool Present(int card) const;
+    bool Asleep(int card) const;
+    int Answering() const;
+    int WaitForCard(uint64_t timeout_ms);
+    void Select(int card, nfc_target *nt);
+    void Delay() const;
+    double Random();
+
+    int Fail(int error);
+    int Nak();
+    int Reply(uint8_t *rx, size_t rx_len, const uint8_t *data, size_t len);
+    int ClassicCommand(Card &card, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+    int UltralightCommand(Card &card, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+
+    std::string         connstring;
+    std::string         name;
+    Family              family;
+    size_t              units;          // blocks (Classic) or pages (Ultralight)
+    uint8_t             atqa[2];
+    uint8_t             sak;
+    bool                has_version;
+    uint8_t             version[8];
+    std::vector<Card>   cards;
+
+    bool                stack;          // all cards are in the field together
+    uint32_t            dwell_ms;
+    uint32_t            gap_ms;
+    uint32_t            latency_us;
+    double              error_rate;
+    uint64_t            rng;
+    uint64_t            epoch;
+
+    bool                easy_framing;
+    bool                infinite_select;
+    int                 selected;       // card index, -1 when none is selected
+    int64_t             selected_tap;
+    bool                halted;
+    int                 authed;         // Classic sector, -1 when none
+    bool                has_transfer;
+    int32_t             transfer_value;
+    uint8_t             transfer_addr;
+    int                 last_error;
+    std::atomic<bool>   aborted;        // set by AbortCommand, cleared by the command it cuts short
+};
+
+#endif // _NFC_SIM_H_
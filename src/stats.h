@@ -0,0 +1,132 @@
+#ifndef _NFC_STATS_H_
+#  define _NFC_STATS_H_
+
+#  include <stdint.h>
+#  include <stddef.h>
+#  include <atomic>
+
+#  define HISTOGRAM_BUCKETS 128
+
+/**
+ * Log-linear histogram: exact below 4, then four buckets per power of two, so a
+ * percentile is off by at most 25%. Values past the last bucket land in it.
+ * Recording is a few relaxed atomic adds and nothing is allocated, so it stays
+ * on in production; readers of a snapshot may see a recording half applied.
+ */
+class Histogram {
+  public:
+    struct Summary {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+    };
+
+    Histogram() {
+        Reset();
+    }
+
+    void Record(uint64_t value) {
+        buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+    }
+
+    void Reset() {
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) buckets[i].store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    // Percentiles are the upper bound of their bucket, capped at the largest value seen.
+    void Summarize(Summary &summary) const {
+        uint64_t counts[HISTOGRAM_BUCKETS], total = 0;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) total += counts[i] = buckets[i].load(std::memory_order_relaxed);
+
+        summary.count = total;
+        summary.sum = sum.load(std::memory_order_relaxed);
+        summary.max = max.load(std::memory_order_relaxed);
+        summary.p50 = Percentile(counts, total, 50, summary.max);
+        summary.p90 = Percentile(counts, total, 90, summary.max);
+        summary.p99 = Percentile(counts, total, 99, summary.max);
+    }
+
+    static size_t BucketOf(uint64_t value) {
+        if (value < 4) return (size_t) value;
+        size_t exponent = 63 - __builtin_clzll(value);
+        size_t bucket = 4 + (exponent - 2) * 4 + ((value >> (exponent - 2)) & 3);
+        return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+    }
+
+    static uint64_t BucketLimit(size_t bucket) {
+        if (bucket < 4) return bucket;
+        size_t shift = (bucket - 4) / 4;
+        return ((uint64_t) (4 + (bucket - 4) % 4 + 1) << shift) - 1;
+    }
+
+  private:
+    static uint64_t Percentile(const uint64_t *counts, uint64_t total, unsigned percent, uint64_t max) {
+        if (total == 0) return 0;
+        uint64_t rank = (total * percent + 99) / 100, seen = 0;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) return BucketLimit(i) < max ? BucketLimit(i) : max;
+        }
+        return max;
+    }
+
+    std::atomic<uint32_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+#  define STATS_ERROR_CLASSES 16
+
+/**
+ * Where a reader's time goes, recorded by its thread (and the JS thread for the
+ * queue and callback stages). Times are in microseconds. Kept with the NFC
+ * object, so the figures add up across restarts until reset.
+ */
+struct ReaderStats {
+    Histogram latency;          // tag found until its read callback returned
+    Histogram probe;            // RATS probe for the Classic card size
+    Histogram read;             // tag found until the read was queued (includes probe)
+    Histogram queue;            // waiting in the queue for the JS thread
+    Histogram callback;         // running the read listeners
+    Histogram auth_attempts;    // authentication frames per Classic read
+    Histogram frames;           // frames exchanged with the tag per read
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> failed_reads;
+    std::atomic<uint64_t> polls;                // polls and probes the host sent while no tag was selected
+    std::atomic<uint64_t> failures[STATS_ERROR_CLASSES];   // failed frames, by error class
+
+    ReaderStats() {
+        Reset();
+    }
+
+    void Failure(size_t error_class) {
+        failures[error_class < STATS_ERROR_CLASSES ? error_class : 0].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Reset() {
+        latency.Reset();
+        probe.Reset();
+        read.Reset();
+        queue.Reset();
+        callback.Reset();
+        auth_attempts.Reset();
+        frames.Reset();
+        reads.store(0, std::memory_order_relaxed);
+        failed_reads.store(0, std::memory_order_relaxed);
+        polls.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < STATS_ERROR_CLASSES; i++) failures[i].store(0, std::memory_order_relaxed);
+    }
+};
+
+#endif // _NFC_STATS_H_
@@ -0,0 +1,156 @@
+#ifndef _NFC_TAG_QUEUE_H_
+#  define _NFC_TAG_QUEUE_H_
+
+#  include <stddef.h>
+#  include <atomic>
+#  include <uv.h>
+
+typedef enum {
+  TQ_DROP_OLDEST,
+  TQ_DROP_NEWEST,
+  TQ_BLOCK
+} tag_queue_overflow;
+
+/**
+ * Bounded single-producer/single-consumer ring of owned pointers.
+ *
+ * The reader thread pushes, the JS thread pops. Both sides only touch the
+ * head/tail indices, the mutex is used solely to park the producer when the
+ * overflow policy is TQ_BLOCK, or for items pushed with keep. Those are never
+ * dropped: a full queue makes the producer wait for room, and drop-oldest drops
+ * the new item instead of a kept one. Items dropped on overflow are handed to
+ * dispose, or deleted when there is none.
+ */
+template <class T>
+class TagQueue {
+  public:
+    typedef void (*Dispose)(T *item);
+
+    TagQueue(size_t capacity, tag_queue_overflow overflow, Dispose dispose = NULL)
+        : overflow(overflow), dispose(dispose), head(0), tail(0), pushed(0), dropped(0), highWater(0), blocked(false), closed(false) {
+        this->capacity = CapacityFor(capacity);
+        mask = this->capacity - 1;
+        slots = new std::atomic<T*>[this->capacity];
+        kept = new bool[this->capacity];
+        uv_mutex_init(&mutex);
+        uv_cond_init(&cond);
+    }
+
+    ~TagQueue() {
+        T *item;
+        while ((item = Pop()) != NULL) Drop(item);
+        delete[] slots;
+        delete[] kept;
+        uv_cond_destroy(&cond);
+        uv_mutex_destroy(&mutex);
+    }
+
+    // The capacity asked for, rounded up to a power of two.
+    static size_t CapacityFor(size_t capacity) {
+        size_t rounded;
+        for (rounded = 1; rounded < capacity; rounded <<= 1);
+        return rounded;
+    }
+
+    // Producer side, takes ownership of item. Returns false if it was dropped.
+    bool Push(T *item, bool keep = false) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t h = head.load(std::memory_order_acquire);
+            if (t - h < capacity) break;
+
+            if (!keep && (overflow == TQ_DROP_NEWEST || (overflow == TQ_DROP_OLDEST && kept[h & mask]))) {
+                dropped++;
+                Drop(item);
+                return false;
+            }
+            if (!keep && overflow == TQ_DROP_OLDEST) {
+                // race the consumer for the oldest slot, whoever advances head owns it.
+                T *oldest = slots[h & mask].load(std::memory_order_relaxed);
+                if (head.compare_exchange_strong(h, h + 1, std::memory_order_seq_cst)) {
+                    dropped++;
+                    Drop(oldest);
+                }
+                continue;
+            }
+
+            // blocked is set before head is looked at again, so Pop either sees it or frees a slot first.
+            uv_mutex_lock(&mutex);
+            blocked.store(true);
+            while (!closed && t - head.load() >= capacity) uv_cond_wait(&cond, &mutex);
+            blocked.store(false);
+            bool abandon = closed;
+            uv_mutex_unlock(&mutex);
+            if (abandon) {
+                dropped++;
+                Drop(item);
+                return false;
+            }
+        }
+
+        slots[t & mask].store(item, std::memory_order_relaxed);
+        kept[t & mask] = keep;     //only the producer reads it, for slots it has filled itself
+        tail.store(t + 1, std::memory_order_release);
+        pushed++;
+
+        size_t depth = t + 1 - head.load(std::memory_order_relaxed);
+        if (depth > highWater.load(std::memory_order_relaxed)) highWater.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side. Returns NULL when empty.
+    T *Pop() {
+        size_t h = head.load(std::memory_order_acquire);
+        for (;;) {
+            if (h == tail.load(std::memory_order_acquire)) return NULL;
+
+            T *item = slots[h & mask].load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(h, h + 1, std::memory_order_seq_cst, std::memory_order_acquire)) {
+                if (overflow == TQ_BLOCK || blocked.load()) {
+                    uv_mutex_lock(&mutex);
+                    uv_cond_signal(&cond);
+                    uv_mutex_unlock(&mutex);
+                }
+                return item;
+            }
+        }
+    }
+
+    // Releases a producer blocked in Push, used when the reader is stopping.
+    void Close() {
+        uv_mutex_lock(&mutex);
+        closed = true;
+        uv_cond_broadcast(&cond);
+        uv_mutex_unlock(&mutex);
+    }
+
+    size_t Capacity() const { return capacity; }
+    size_t Depth() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    size_t Pushed() const { return pushed.load(std::memory_order_relaxed); }
+    size_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+    size_t HighWater() const { return highWater.load(std::memory_order_relaxed); }
+
+  private:
+    void Drop(T *item) {
+        if (dispose) dispose(item);
+        else delete item;
+    }
+
+    tag_queue_overflow  overflow;
+    Dispose             dispose;
+    size_t              capacity;
+    size_t              mask;
+    std::atomic<T*>     *slots;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<size_t> pushed;
+    std::atomic<size_t> dropped;
+    std::atomic<size_t> highWater;
+    bool                *kept;          // per slot, pushed with keep
+    std::atomic<bool>   blocked;        // the producer waits for room
+    uv_mutex_t          mutex;
+    uv_cond_t           cond;
+    bool                closed;
+};
+
+#endif // _NFC_TAG_QUEUE_H_
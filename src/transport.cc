@@ -0,0 +1,73 @@
+#include <string.h>
+#include "transport.h"
+#include "sim.h"
+
+Transport *Transport::Open(nfc_context *context, const char *connstring) {
+    if (connstring && strncmp(connstring, "sim:", 4) == 0) return SimTransport::Open(connstring);
+
+    nfc_device *pnd = nfc_open(context, connstring);
+    return pnd ? new LibnfcTransport(pnd) : NULL;
+}
+
+LibnfcTransport::~LibnfcTransport() {
+    nfc_close(pnd);
+}
+
+const char *LibnfcTransport::Connstring() {
+    return nfc_device_get_connstring(pnd);
+}
+
+const char *LibnfcTransport::Name() {
+    return nfc_device_get_name(pnd);
+}
+
+int LibnfcTransport::InformationAbout(std::string &info) {
+    char *text;
+    int res = nfc_device_get_information_about(pnd, &text);
+    if (res < 0) return res;
+
+    info = text;
+    nfc_free(text);
+    return res;
+}
+
+const char *LibnfcTransport::StrError() {
+    return nfc_strerror(pnd);
+}
+
+int LibnfcTransport::InitiatorInit() {
+    return nfc_initiator_init(pnd);
+}
+
+int LibnfcTransport::SetPropertyBool(nfc_property property, bool enable) {
+    return nfc_device_set_property_bool(pnd, property, enable);
+}
+
+int LibnfcTransport::PollTarget(const nfc_modulation *modulations, size_t count, uint8_t poll_count, uint8_t poll_period,
+                                nfc_target *nt) {
+    return nfc_initiator_poll_target(pnd, modulations, count, poll_count, poll_period, nt);
+}
+
+int LibnfcTransport::SelectPassiveTarget(nfc_modulation nm, const uint8_t *init_data, size_t init_data_len, nfc_target *nt) {
+    return nfc_initiator_select_passive_target(pnd, nm, init_data, init_data_len, nt);
+}
+
+int LibnfcTransport::ListPassiveTargets(nfc_modulation nm, nfc_target *targets, size_t count) {
+    return nfc_initiator_list_passive_targets(pnd, nm, targets, count);
+}
+
+int LibnfcTransport::DeselectTarget() {
+    return nfc_initiator_deselect_target(pnd);
+}
+
+int LibnfcTransport::TargetIsPresent(const nfc_target *nt) {
+    return nfc_initiator_target_is_present(pnd, nt);
+}
+
+int LibnfcTransport::TransceiveBytes(const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len, int timeout) {
+    return nfc_initiator_transceive_bytes(pnd, tx, tx_len, rx, rx_len, timeout);
+}
+
+int LibnfcTransport::AbortCommand() {
+    return nfc_abort_command(pnd);
+}
@@ -0,0 +1,60 @@
+#ifndef _NFC_TRANSPORT_H_
+#  define _NFC_TRANSPORT_H_
+
+#  include <string>
+#  include <nfc/nfc.h>
+
+/**
+ * What the reader needs from a device, one method per libnfc call it makes.
+ * Return values and error codes are libnfc's. The reader thread owns the
+ * transport; only AbortCommand may be called from another thread.
+ */
+class Transport {
+  public:
+    virtual ~Transport() {}
+
+    virtual const char *Connstring() = 0;
+    virtual const char *Name() = 0;
+    virtual int InformationAbout(std::string &info) = 0;
+    virtual const char *StrError() = 0;
+
+    virtual int InitiatorInit() = 0;
+    virtual int SetPropertyBool(nfc_property property, bool enable) = 0;
+    virtual int PollTarget(const nfc_modulation *modulations, size_t count, uint8_t poll_count, uint8_t poll_period,
+                           nfc_target *nt) = 0;
+    virtual int SelectPassiveTarget(nfc_modulation nm, const uint8_t *init_data, size_t init_data_len, nfc_target *nt) = 0;
+    virtual int ListPassiveTargets(nfc_modulation nm, nfc_target *targets, size_t count) = 0;
+    virtual int DeselectTarget() = 0;
+    virtual int TargetIsPresent(const nfc_target *nt) = 0;
+    virtual int TransceiveBytes(const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len, int timeout) = 0;
+    virtual int AbortCommand() = 0;
+
+    // libnfc device for connstring (the default device when NULL), or the simulator for "sim:..." connstrings.
+    static Transport *Open(nfc_context *context, const char *connstring);
+};
+
+class LibnfcTransport : public Transport {
+  public:
+    explicit LibnfcTransport(nfc_device *pnd) : pnd(pnd) {}
+    ~LibnfcTransport();
+
+    const char *Connstring();
+    const char *Name();
+    int InformationAbout(std::string &info);
+    const char *StrError();
+
+    int InitiatorInit();
+    int SetPropertyBool(nfc_property property, bool enable);
+    int PollTarget(const nfc_modulation *modulations, size_t count, uint8_t poll_count, uint8_t poll_period, nfc_target *nt);
+    int SelectPassiveTarget(nfc_modulation nm, const uint8_t *init_data, size_t init_data_len, nfc_target *nt);
+    int ListPassiveTargets(nfc_modulation nm, nfc_target *targets, size_t count);
+    int DeselectTarget();
+    int TargetIsPresent(const nfc_target *nt);
+    int TransceiveBytes(const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len, int timeout);
+    int AbortCommand();
+
+  private:
+    nfc_device *pnd;
+};
+
+#endif // _NFC_TRANSPORT_H_
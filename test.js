@@ -1,7 +1,8 @@
 var nfc  = require('./index').nfc
   , util = require('util')
   , version = nfc.version()
-  , devices = nfc.scan()
+  , deviceID = process.argv[2]  // e.g. 'sim:classic1k' to run without a reader
+  , devices = deviceID ? {} : nfc.scan()
   ;
 
 console.log('version: ' + util.inspect(version, { depth: null }));
@@ -13,7 +14,7 @@ function read(deviceID) {
 
   nfcdev.on('read', function(tag) {
     console.log(util.inspect(tag, { depth: null }));
-    if ((!!tag.data) && (!!tag.offset)) console.log(util.inspect(nfc.parse(tag.data.slice(tag.offset)), { depth: null }));
+    if (!!tag.data) console.log(util.inspect(nfc.parse(tag.data.slice(tag.offset)), { depth: null }));
     nfcdev.stop();
   });
 
@@ -28,4 +29,5 @@ function read(deviceID) {
   console.log(nfcdev.start(deviceID));
 }
 
-for (var deviceID in devices) read(deviceID);
\ No newline at end of file
+if (deviceID) read(deviceID);
+else for (deviceID in devices) read(deviceID);
\ No newline at end of file
@@ -0,0 +1,465 @@
+// Regression tests against simulated readers, no hardware needed: node test/sim.js
+
+var nfc    = require('../index').nfc
+  , assert = require('assert')
+  , fs     = require('fs')
+  , os     = require('os')
+  , path   = require('path')
+  ;
+
+var tests = [], failed = 0, current;
+
+function test(name, fn) {
+  tests.push({ name: name, fn: fn });
+}
+
+// Starts a reader on deviceID and hands the first read to fn(device, tag, done).
+function withRead(deviceID, options, fn) {
+  return function(done) {
+    var device = new nfc.NFC();
+    device.on('error', done);
+    device.once('read', function(tag) {
+      try {
+        fn(device, tag, function(err) {
+          device.stop().then(function() { done(err); });
+        });
+      } catch (err) {
+        device.stop().then(function() { done(err); });
+      }
+    });
+    device.start(deviceID, options);
+  };
+}
+
+// Node style callback that fails the test on error, or passes the result to fn.
+function check(done, fn) {
+  return function(err, result) {
+    if (err) return done(err);
+    try {
+      fn(result);
+    } catch (e) {
+      return done(e);
+    }
+  };
+}
+
+// Stops the device, then ends the test with err.
+function stopping(device, done) {
+  return function(err) {
+    device.stop().then(function() { done(err); });
+  };
+}
+
+// pause() tells whether the reader was paused, it is resumed again when it wasn't.
+function isPaused(device) {
+  var paused = device.pause();
+  if (!paused) device.resume();
+  return paused;
+}
+
+// value, ~value, value, then the address byte as addr, ~addr, addr, ~addr.
+function valueBlock(value, addr) {
+  var block = Buffer.alloc(16);
+  block.writeInt32LE(value, 0);
+  block.writeInt32LE(~value, 4);
+  block.writeInt32LE(value, 8);
+  block[12] = addr; block[13] = ~addr & 0xff; block[14] = addr; block[15] = ~addr & 0xff;
+  return block;
+}
+
+test('classic 1k full read with a non-default key', withRead('sim:classic1k,key=abcdef123456',
+  { keys: Buffer.from('abcdef123456', 'hex'), timings: true }, function(device, tag, done) {
+    assert.ifError(tag.error);
+    assert.strictEqual(tag.uid, '5e:a1:3c:01');
+    assert.strictEqual(tag.type, 0x04);
+    assert.strictEqual(tag.tag, 'mifare-classic');
+    assert.strictEqual(tag.data.length - tag.offset, 1024);
+    assert.deepEqual(Array.prototype.slice.call(tag.data, tag.offset, tag.offset + 4), [ 0x5e, 0xa1, 0x3c, 0x01 ]);
+    done();
+  }));
+
+test('classic keys are cached per card', function(done) {
+  var attempts = [], device = new nfc.NFC();
+  device.on('error', done).on('read', function(tag) {
+    attempts.push(tag.error || tag.auth.attempts);
+    if (attempts.length !== 2) return;
+    device.stop().then(function() {
+      // the first read tries the dictionary in order, the second only the cached key of each sector.
+      assert.ok(attempts[0] > 16, 'first read: ' + attempts[0]);
+      assert.strictEqual(attempts[1], 16);
+      done();
+    }).catch(done);
+  });
+  device.start('sim:classic1k,uid=11223344,key=abcdef123456',
+               { keys: Buffer.from('ffffffffffffa0a1a2a3a4a5abcdef123456', 'hex'), presence: false });
+});
+
+test('ntag215 read with FAST_READ', withRead('sim:ntag215', { timings: true }, function(device, tag, done) {
+  assert.ifError(tag.error);
+  assert.strictEqual(tag.type, 0x44);
+  assert.strictEqual(tag.data.length - tag.offset, 135 * 4);
+  assert.strictEqual(tag.data[tag.offset + 12], 0xe1);
+  // GET_VERSION plus three FAST_READs, plain READs would take 34 frames.
+  assert.ok(tag.timings.frames <= 6, 'frames: ' + tag.timings.frames);
+  done();
+}));
+
+test('readBlocks outside the tag fails', withRead('sim:ntag213', {}, function(device, tag, done) {
+  device.readBlocks(40, 10, function(err) {
+    done(err instanceof Error ? null : new Error('pages 40 to 49 of a 45 page tag were read'));
+  });
+}));
+
+test('value block operations', withRead('sim:classic1k', {}, function(device, tag, done) {
+  device.write({ 4: valueBlock(1000, 4) }, check(done, function() {
+    device.increment(4, 5, check(done, function(result) {
+      assert.strictEqual(result.value, 1005);
+      device.decrement(4, 10, check(done, function(result) {
+        assert.strictEqual(result.value, 995);
+        device.restore(4, { transfer: 5 }, check(done, function(result) {
+          assert.strictEqual(result.value, 995);
+          assert.strictEqual(result.block, 5);
+          device.readBlocks(5, 1, check(done, function(data) {
+            assert.strictEqual(data.readInt32LE(0), 995);
+            done();
+          }));
+        }));
+      }));
+    }));
+  }));
+}));
+
+test('stop and restart', function(done) {
+  var device = new nfc.NFC();
+  device.on('error', done);
+  device.once('read', function(first) {
+    device.stop().then(function() {
+      device.once('read', function(second) {
+        assert.strictEqual(second.uid, first.uid);
+        device.stop().then(function() { done(); });
+      });
+      device.start('sim:ultralight');
+    }).catch(done);
+  });
+  device.start('sim:ultralight');
+});
+
+test('stopping a paused reader', function(done) {
+  var device = new nfc.NFC();
+  device.on('error', done).on('read', function() {
+    done(new Error('read while paused'));
+  });
+  device.start('sim:classic1k', { paused: true });
+  setTimeout(function() {
+    device.stop().then(function() { done(); });
+  }, 50);
+});
+
+// The one tap of these readers is over by the time polling starts.
+var emptyReader = 'sim:ntag213,dwell=1,gap=60000';
+
+test('readOnce resolves with a read and pauses the reader again', function(done) {
+  var device = new nfc.NFC(), end = stopping(device, done);
+  device.on('error', done);
+  device.start('sim:ntag213', { paused: true });
+  device.readOnce({ timeout: 2000 }).then(function(tag) {
+    assert.strictEqual(tag.type, 0x44);
+    assert.ok(isPaused(device), 'polling after readOnce');
+  }).then(end, end);
+});
+
+test('readOnce leaves a polling reader polling', function(done) {
+  var device = new nfc.NFC(), end = stopping(device, done);
+  device.on('error', done);
+  device.start('sim:ntag213');
+  device.readOnce().then(function(tag) {
+    assert.strictEqual(tag.type, 0x44);
+    assert.ok(!isPaused(device), 'paused after readOnce');
+  }).then(end, end);
+});
+
+test('readOnce rejects after its timeout', function(done) {
+  var device = new nfc.NFC(), end = stopping(device, done);
+  device.on('error', done);
+  device.start(emptyReader, { paused: true });
+  setTimeout(function() {
+    var started = Date.now();
+    device.readOnce({ timeout: 100 }).then(function() {
+      throw new Error('read without a card on the reader');
+    }, function(err) {
+      assert.ok(/within 100ms/.test(err.message), err.message);
+      assert.ok(Date.now() - started >= 90, 'rejected after ' + (Date.now() - started) + 'ms');
+      assert.ok(isPaused(device), 'polling after readOnce timed out');
+    }).then(end, end);
+  }, 20);
+});
+
+test('reads() pauses polling at highWaterMark', function(done) {
+  var device = new nfc.NFC(), end = stopping(device, done), count = 0;
+  device.on('error', done).on('read', function() { count++; });
+  device.start('sim:ntag213', { presence: false });
+  var reads = device.reads({ highWaterMark: 2 });
+
+  setTimeout(function() {
+    // reads the native queue held when polling paused still come in, then no more.
+    var settled = count;
+    setTimeout(function() {
+      try {
+        assert.ok(settled >= 2, 'reads: ' + settled);
+        assert.strictEqual(count, settled);
+        assert.ok(isPaused(device), 'polling with ' + count + ' reads waiting');
+      } catch (err) {
+        return end(err);
+      }
+      reads.next().then(function(result) {
+        assert.strictEqual(result.done, false);
+        assert.strictEqual(result.value.type, 0x44);
+        assert.ok(!isPaused(device), 'paused after a pull');
+        return reads.return();
+      }).then(function(result) {
+        assert.strictEqual(result.done, true);
+      }).then(end, end);
+    }, 100);
+  }, 200);
+});
+
+test('reads() ends when the reader stops', function(done) {
+  var device = new nfc.NFC();
+  device.on('error', done);
+  device.start(emptyReader, { paused: true });
+  setTimeout(function() {
+    var reads = device.reads();
+    reads.next().then(function(result) {
+      assert.strictEqual(result.done, true);
+      return reads.next();
+    }).then(function(result) {
+      assert.strictEqual(result.done, true);
+      done();
+    }).catch(done);
+    device.stop();
+  }, 20);
+});
+
+test('reads() rejects when the reader is lost', function(done) {
+  var device = new nfc.NFC(), end = stopping(device, done), lost = new Error('device lost');
+  device.on('error', done);
+  device.start(emptyReader, { paused: true });
+  setTimeout(function() {
+    var reads = device.reads();
+    reads.next().then(function() {
+      throw new Error('read without a card on the reader');
+    }, function(err) {
+      assert.strictEqual(err, lost);
+      return reads.next();
+    }).then(function(result) {
+      assert.strictEqual(result.done, true);
+    }).then(end, end);
+    device.emit('stopped', lost);   // as the native reader does when its device goes away
+  }, 20);
+});
+
+// Journal positions are the segment number in the high 32 bits and the offset in it below.
+function segmentOf(position) {
+  return Math.floor(position / 0x100000000);
+}
+
+// Asserts that a journal record holds what the read reported.
+function assertJournaled(record, tag) {
+  assert.strictEqual(record.position, tag.journal);
+  assert.strictEqual(record.uid, tag.uid);
+  assert.strictEqual(record.type, tag.type);
+  assert.ok(record.data.slice(record.offset).equals(tag.data.slice(tag.offset)), 'data at ' + tag.journal);
+}
+
+// Starts a reader on the journal and hands its reads to fn(tags) once it stopped after until(tags) held.
+function journalReads(options, until, fn) {
+  var tags = [], device = new nfc.NFC();
+  device.on('read', function(tag) {
+    tags.push(tag);
+    if (!until(tags)) return;
+    until = function() { return false; };
+    device.stop().then(function() { fn(tags); });
+  });
+  device.start('sim:classic4k', options);
+  return device;
+}
+
+test('journal records match the reads across a rotation and a reopen', function(done) {
+  var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'nfc-journal-'))
+    , options = { journal: dir, journalSegmentSize: 65536, journalSegments: 2
+                , presence: false, overflow: 'block' };
+
+  var finish = function(err) {
+    fs.readdirSync(dir).forEach(function(file) { fs.unlinkSync(path.join(dir, file)); });
+    fs.rmdirSync(dir);
+    done(err);
+  };
+
+  // 4 KiB reads fill a 64 KiB segment in about 15, read until the journal has moved on to the next one.
+  journalReads(options, function(tags) {
+    return segmentOf(tags[tags.length - 1].journal) > segmentOf(tags[0].journal);
+  }, function(first) {
+    try {
+      var all = nfc.readJournal(dir), byPosition = {};
+      all.records.forEach(function(record) { byPosition[record.position] = record; });
+      assert.ok(segmentOf(all.records[all.records.length - 1].position) > segmentOf(all.records[0].position), 'no rotation');
+      first.forEach(function(tag) {
+        // reads still queued when the reader stopped may have rotated the oldest segment away.
+        if (segmentOf(tag.journal) >= segmentOf(all.records[0].position)) assertJournaled(byPosition[tag.journal], tag);
+      });
+
+      // by position, and by time.
+      var middle = all.records[all.records.length >> 1];
+      assert.strictEqual(nfc.readJournal(dir, { from: middle.position, limit: 1 }).records[0].position, middle.position);
+      assert.deepEqual(nfc.readJournal(dir, { since: middle.time }).records.map(function(record) { return record.position; }),
+                       all.records.filter(function(record) { return record.time >= middle.time; })
+                              .map(function(record) { return record.position; }));
+    } catch (err) {
+      return finish(err);
+    }
+
+    // a reader opening the journal again appends after the last record.
+    journalReads(options, function(tags) { return tags.length >= 3; }, function(second) {
+      try {
+        var more = nfc.readJournal(dir, { from: all.next });
+        assert.ok(second[0].journal >= all.next, 'appended at ' + second[0].journal + ', before ' + all.next);
+        assert.strictEqual(more.records.length, second.length);
+        second.forEach(function(tag, i) { assertJournaled(more.records[i], tag); });
+      } catch (err) {
+        return finish(err);
+      }
+
+      var streamed = [];
+      nfc.createJournalStream(dir, { batchSize: 7 }).on('data', function(record) {
+        streamed.push(record.position);
+      }).on('error', finish).on('end', function() {
+        try {
+          assert.deepEqual(streamed, nfc.readJournal(dir).records.map(function(record) { return record.position; }));
+        } catch (err) {
+          return finish(err);
+        }
+        finish();
+      });
+    }).on('error', finish);
+  }).on('error', finish);
+});
+
+test('inventory of a stack of cards', function(done) {
+  var inventories = [], device = new nfc.NFC();
+  device.on('error', done).on('read', function() {
+    done(new Error('read outside of an inventory'));
+  }).on('inventory', function(inventory) {
+    inventories.push(inventory);
+    if (!inventory.departed.length) return;
+    device.stop().then(function() {
+      // listed once while the stack stays, through some 20 cycles, then departed together.
+      assert.strictEqual(inventories.length, 2);
+      var uids = inventories[0].tags.map(function(tag) { return tag.uid; });
+      assert.strictEqual(uids.length, 3);
+      assert.strictEqual(uids.filter(function(uid, i) { return uids.indexOf(uid) === i; }).length, 3);
+      assert.strictEqual(inventories[0].departed.length, 0);
+      assert.strictEqual(inventories[1].tags.length, 0);
+      assert.deepEqual(inventories[1].departed.map(function(tag) { return tag.uid; }).sort(), uids.sort());
+      done();
+    }).catch(done);
+  });
+  device.start('sim:ntag213,cards=3,stack,dwell=400,gap=60000', { inventory: true, presenceInterval: 20, debounce: 100 });
+});
+
+// A view into data rather than a copy.
+function assertSlice(view, data, offset, length) {
+  assert.ok(Buffer.isBuffer(view));
+  assert.strictEqual(view.buffer, data.buffer);
+  assert.strictEqual(view.byteOffset, data.byteOffset + offset);
+  assert.strictEqual(view.length, length);
+}
+
+test('parse a short record between NULL TLVs', function(done) {
+  // NULL, NULL, NDEF message TLV: MB ME SR IL, TNF 1, type U, id ab, payload 04 78 79; terminator.
+  var data = Buffer.from('0000030ad9010302556162047879fe', 'hex'), tlvs = nfc.parse(data);
+  assert.strictEqual(tlvs.length, 2);
+  assert.strictEqual(tlvs[0].type, 3);
+  assert.strictEqual(tlvs[0].len, 10);
+  assertSlice(tlvs[0].value, data, 4, 10);
+  assert.strictEqual(tlvs[0].ndef.length, 1);
+  var record = tlvs[0].ndef[0];
+  assert.deepEqual([ record.tnf, record.mb, record.me, record.cf ], [ 1, true, true, false ]);
+  assertSlice(record.type, data, 8, 1);
+  assertSlice(record.id, data, 9, 2);
+  assertSlice(record.payload, data, 11, 3);
+  assert.strictEqual(record.id.toString(), 'ab');
+  assert.deepEqual(tlvs[1], { type: 0xfe });
+  done();
+});
+
+test('parse a TLV with a three byte length', function(done) {
+  // 0xff then a 16 bit length (307), holding a record with a 4 byte payload length (300).
+  var data = Buffer.concat([ Buffer.from('03ff0133c1010000012c54', 'hex'), Buffer.alloc(300, 0x41), Buffer.from([ 0xfe ]) ])
+    , tlvs = nfc.parse(data);
+  assert.strictEqual(tlvs.length, 2);
+  assert.strictEqual(tlvs[0].len, 307);
+  assertSlice(tlvs[0].value, data, 4, 307);
+  assert.strictEqual(tlvs[0].ndef.length, 1);
+  assert.strictEqual(tlvs[0].ndef[0].id, undefined);
+  assertSlice(tlvs[0].ndef[0].type, data, 10, 1);
+  assertSlice(tlvs[0].ndef[0].payload, data, 11, 300);
+  assert.strictEqual(tlvs[1].type, 0xfe);
+  done();
+});
+
+test('parse a truncated message', function(done) {
+  // the TLV claims 10 bytes and 5 follow: its length is reported, without value or records.
+  var tlvs = nfc.parse(Buffer.from('030ad101035504', 'hex'));
+  assert.deepEqual(tlvs, [ { type: 3, len: 10 } ]);
+
+  // the TLV is complete but its record claims a 9 byte payload: the value is kept, the records are not.
+  var data = Buffer.from('0305d101095504fe', 'hex');
+  tlvs = nfc.parse(data);
+  assert.strictEqual(tlvs.length, 2);
+  assertSlice(tlvs[0].value, data, 2, 5);
+  assert.strictEqual(tlvs[0].ndef, undefined);
+  assert.strictEqual(tlvs[1].type, 0xfe);
+  done();
+});
+
+test('modulation and baud rate pairs libnfc rejects', function(done) {
+  [ 'felica@106', 'iso14443a@847', 'jewel@424' ].forEach(function(modulation) {
+    assert.throws(function() {
+      new nfc.NFC().start('sim:ntag213', { modulations: [ modulation ] });
+    }, /baud rate of/, modulation);
+  });
+  var device = new nfc.NFC();
+  device.start('sim:ntag213', { modulations: [ 'iso14443a@106', 'felica@424', 'iso14443b@847' ], paused: true });
+  device.stop().then(function() { done(); }, done);
+});
+
+function next(i) {
+  if (i === tests.length) {
+    console.log(failed ? failed + ' of ' + tests.length + ' failed' : 'all ' + tests.length + ' passed');
+    process.exit(failed ? 1 : 0);
+  }
+
+  var finished = false, timer = setTimeout(function() { finish(new Error('timed out')); }, 5000);
+  function finish(err) {
+    if (finished) return;
+    finished = true;
+    clearTimeout(timer);
+    if (err) failed++;
+    console.log((err ? 'not ok ' : 'ok ') + (i + 1) + ' ' + tests[i].name + (err ? '\n  ' + (err.stack || err) : ''));
+    setImmediate(function() { next(i + 1); });
+  }
+
+  current = finish;
+  try {
+    tests[i].fn(finish);
+  } catch (err) {
+    finish(err);
+  }
+}
+
+// Assertions in native callbacks throw outside the test function.
+process.on('uncaughtException', function(err) {
+  current(err);
+});
+
+next(0);